@@ -0,0 +1,118 @@
+#include "buf_pool.h"
+
+#include <linux/mm.h>
+#include <linux/shrinker.h>
+#include <linux/slab.h>
+
+#define VTFS_BUF_POOL_INIT(name, buf_size, max)                                \
+  {                                                                            \
+    .lock = __SPIN_LOCK_UNLOCKED(name.lock),                                   \
+    .idle = LIST_HEAD_INIT(name.idle), .nr_idle = 0, .max_idle = (max),        \
+    .size = (buf_size)                                                         \
+  }
+
+// Enough for every request of a couple of busy mounts in flight at once
+struct vtfs_buf_pool vtfs_small_bufs =
+    VTFS_BUF_POOL_INIT(vtfs_small_bufs, VTFS_SMALL_BUF_SIZE, 64);
+// One per read or write chunk in flight on a couple of mounts
+struct vtfs_buf_pool vtfs_large_bufs =
+    VTFS_BUF_POOL_INIT(vtfs_large_bufs, VTFS_LARGE_BUF_SIZE, 16);
+
+void *vtfs_buf_get(struct vtfs_buf_pool *pool, size_t len) {
+  struct list_head *buf = NULL;
+
+  if (len > pool->size) {
+    return kvmalloc(len, GFP_KERNEL);
+  }
+
+  spin_lock(&pool->lock);
+  if (!list_empty(&pool->idle)) {
+    buf = pool->idle.next;
+    list_del(buf);
+    pool->nr_idle--;
+  }
+  spin_unlock(&pool->lock);
+
+  if (buf) {
+    return buf;
+  }
+  return kvmalloc(pool->size, GFP_KERNEL);
+}
+
+void vtfs_buf_put(struct vtfs_buf_pool *pool, void *buf, size_t len) {
+  if (buf == NULL) {
+    return;
+  }
+
+  if (len <= pool->size) {
+    spin_lock(&pool->lock);
+    if (pool->nr_idle < pool->max_idle) {
+      list_add(buf, &pool->idle);
+      pool->nr_idle++;
+      buf = NULL;
+    }
+    spin_unlock(&pool->lock);
+  }
+
+  kvfree(buf);
+}
+
+static struct shrinker *vtfs_buf_shrinker;
+
+// Free up to nr idle buffers of pool, returns how many went
+static unsigned long buf_pool_shrink(struct vtfs_buf_pool *pool,
+                                     unsigned long nr) {
+  struct list_head *buf, *tmp;
+  unsigned long freed = 0;
+  LIST_HEAD(idle);
+
+  // kvfree may sleep, free outside the lock
+  spin_lock(&pool->lock);
+  while (freed < nr && !list_empty(&pool->idle)) {
+    list_move(pool->idle.next, &idle);
+    pool->nr_idle--;
+    freed++;
+  }
+  spin_unlock(&pool->lock);
+
+  list_for_each_safe(buf, tmp, &idle) {
+    list_del(buf);
+    kvfree(buf);
+  }
+  return freed;
+}
+
+static unsigned long buf_pools_count(struct shrinker *shrinker,
+                                     struct shrink_control *sc) {
+  unsigned long nr = READ_ONCE(vtfs_small_bufs.nr_idle) +
+                     READ_ONCE(vtfs_large_bufs.nr_idle);
+
+  return nr ? nr : SHRINK_EMPTY;
+}
+
+// Idle buffers are only a cache, give them up large ones first
+static unsigned long buf_pools_scan(struct shrinker *shrinker,
+                                    struct shrink_control *sc) {
+  unsigned long freed = buf_pool_shrink(&vtfs_large_bufs, sc->nr_to_scan);
+
+  freed += buf_pool_shrink(&vtfs_small_bufs, sc->nr_to_scan - freed);
+  return freed;
+}
+
+int vtfs_buf_pools_init(void) {
+  vtfs_buf_shrinker = shrinker_alloc(0, "vtfs-bufs");
+  if (!vtfs_buf_shrinker) {
+    return -ENOMEM;
+  }
+  vtfs_buf_shrinker->count_objects = buf_pools_count;
+  vtfs_buf_shrinker->scan_objects = buf_pools_scan;
+  vtfs_buf_shrinker->seeks = DEFAULT_SEEKS;
+  shrinker_register(vtfs_buf_shrinker);
+  return 0;
+}
+
+void vtfs_buf_pools_exit(void) {
+  shrinker_free(vtfs_buf_shrinker);
+  buf_pool_shrink(&vtfs_small_bufs, ULONG_MAX);
+  buf_pool_shrink(&vtfs_large_bufs, ULONG_MAX);
+}
@@ -0,0 +1,38 @@
+#ifndef VTFS_BUF_POOL_H
+#define VTFS_BUF_POOL_H
+
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+// Request lines, RPC headers, compound bodies and other small messages
+#define VTFS_SMALL_BUF_SIZE 4096
+// Read and write chunks, directory batches
+#define VTFS_LARGE_BUF_SIZE (256 * 1024)
+
+// Fixed-size buffers kept for reuse, so that the request/response path
+// does not go to the allocator once it is warm. Idle buffers are linked
+// through their own first bytes
+struct vtfs_buf_pool {
+  spinlock_t lock;
+  struct list_head idle;
+  unsigned int nr_idle;
+  unsigned int max_idle;
+  size_t size;
+};
+
+extern struct vtfs_buf_pool vtfs_small_bufs;
+extern struct vtfs_buf_pool vtfs_large_bufs;
+
+// Take a buffer of at least len bytes. Those larger than the pool's size
+// are allocated for the caller alone
+void *vtfs_buf_get(struct vtfs_buf_pool *pool, size_t len);
+// Give back a buffer taken with the same len. NULL is ignored
+void vtfs_buf_put(struct vtfs_buf_pool *pool, void *buf, size_t len);
+
+// Let memory pressure shrink the idle lists, on module load
+int vtfs_buf_pools_init(void);
+// Free the idle buffers of every pool, on module unload
+void vtfs_buf_pools_exit(void);
+
+#endif // VTFS_BUF_POOL_H
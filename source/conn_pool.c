@@ -0,0 +1,148 @@
+#include "conn_pool.h"
+
+#include <linux/in.h>
+#include <linux/inet.h>
+#include <linux/slab.h>
+#include <linux/socket.h>
+#include <linux/tcp.h>
+#include <net/net_namespace.h>
+#include <net/sock.h>
+#include <net/tcp_states.h>
+
+static void conn_release(struct socket *sock) {
+  kernel_sock_shutdown(sock, SHUT_RDWR);
+  sock_release(sock);
+}
+
+static struct socket *conn_open(u16 port) {
+  struct socket *sock;
+
+  int error = sock_create_kern(&init_net, AF_INET, SOCK_STREAM, IPPROTO_TCP, &sock);
+  if (error < 0) {
+    return NULL;
+  }
+
+  struct sockaddr_in s_addr = {.sin_family = AF_INET,
+                               .sin_addr = {.s_addr = in_aton(VTFS_SERVER_IP)},
+                               .sin_port = htons(port)};
+
+  error = kernel_connect(sock, (struct sockaddr *)&s_addr,
+                         sizeof(struct sockaddr_in), 0);
+  if (error != 0) {
+    sock_release(sock);
+    return NULL;
+  }
+
+  // Requests are single writes awaiting a reply, don't let Nagle hold them back
+  tcp_sock_set_nodelay(sock->sk);
+  return sock;
+}
+
+// The server may close an idle connection whenever it likes. Anything
+// readable on one is that EOF or garbage
+static bool conn_alive(struct socket *sock) {
+  struct sock *sk = sock->sk;
+
+  return READ_ONCE(sk->sk_state) == TCP_ESTABLISHED && !READ_ONCE(sk->sk_err) &&
+         skb_queue_empty_lockless(&sk->sk_receive_queue);
+}
+
+void vtfs_conn_pool_init(struct vtfs_conn_pool *pool, u16 port) {
+  spin_lock_init(&pool->lock);
+  INIT_LIST_HEAD(&pool->idle);
+  pool->nr_idle = 0;
+  pool->port = port;
+}
+
+void vtfs_conn_pool_destroy(struct vtfs_conn_pool *pool) {
+  struct vtfs_conn *conn, *tmp;
+
+  list_for_each_entry_safe(conn, tmp, &pool->idle, list) {
+    list_del(&conn->list);
+    conn_release(conn->sock);
+    kfree(conn);
+  }
+  pool->nr_idle = 0;
+}
+
+// Take an idle connection or open a new one. *reused tells which
+struct vtfs_conn *vtfs_conn_get(struct vtfs_conn_pool *pool, bool *reused) {
+  struct vtfs_conn *conn;
+
+  do {
+    conn = NULL;
+    spin_lock(&pool->lock);
+    if (!list_empty(&pool->idle)) {
+      conn = list_first_entry(&pool->idle, struct vtfs_conn, list);
+      list_del(&conn->list);
+      pool->nr_idle--;
+    }
+    spin_unlock(&pool->lock);
+
+    if (conn && conn_alive(conn->sock)) {
+      *reused = true;
+      return conn;
+    }
+    // Closed while idle: a request sent on it could only fail
+    if (conn) {
+      conn_release(conn->sock);
+      kfree(conn);
+    }
+  } while (conn);
+
+  *reused = false;
+
+  conn = kmalloc(sizeof(*conn), GFP_KERNEL);
+  if (conn == NULL) {
+    return NULL;
+  }
+  conn->sock = conn_open(pool->port);
+  if (conn->sock == NULL) {
+    kfree(conn);
+    return NULL;
+  }
+  conn->rstart = 0;
+  conn->rend = 0;
+  return conn;
+}
+
+// Give a healthy connection back, or close it if it is broken or not needed
+void vtfs_conn_put(struct vtfs_conn_pool *pool, struct vtfs_conn *conn,
+                   bool healthy) {
+  if (healthy) {
+    spin_lock(&pool->lock);
+    if (pool->nr_idle < VTFS_CONN_MAX_IDLE) {
+      list_add(&conn->list, &pool->idle);
+      pool->nr_idle++;
+      conn = NULL;
+    }
+    spin_unlock(&pool->lock);
+  }
+
+  if (conn) {
+    conn_release(conn->sock);
+    kfree(conn);
+  }
+}
+
+int vtfs_conn_send(struct vtfs_conn *conn, struct kvec *head,
+                   const struct iov_iter *payload, bool *sent) {
+  size_t payload_len = payload ? iov_iter_count(payload) : 0;
+  struct msghdr msg = {.msg_flags = payload_len ? MSG_MORE : 0};
+
+  int ret = kernel_sendmsg(conn->sock, &msg, head, 1, head->iov_len);
+  *sent = ret > 0;
+  if (ret != head->iov_len) {
+    return -ECONNRESET;
+  }
+  if (payload_len == 0) {
+    return 0;
+  }
+
+  // The payload goes out from wherever the caller keeps it: page cache
+  // folios, kernel buffers, or user memory on the caller's own task
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iter = *payload;
+  ret = sock_sendmsg(conn->sock, &msg);
+  return ret == payload_len ? 0 : -ECONNRESET;
+}
@@ -0,0 +1,50 @@
+#ifndef VTFS_CONN_POOL_H
+#define VTFS_CONN_POOL_H
+
+#include <linux/list.h>
+#include <linux/net.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/uio.h>
+
+#define VTFS_SERVER_IP "127.0.0.1"  // localhost
+#define VTFS_HTTP_PORT 8888
+
+// Idle connections kept per pool
+#define VTFS_CONN_MAX_IDLE 8
+// Input buffered per connection
+#define VTFS_CONN_RBUF 1024
+
+struct vtfs_conn {
+  struct list_head list;
+  struct socket *sock;
+  // Received bytes of the current response not consumed yet
+  size_t rstart;
+  size_t rend;
+  char rbuf[VTFS_CONN_RBUF];
+};
+
+// Persistent connections to one server port, one pool per mount
+struct vtfs_conn_pool {
+  spinlock_t lock;
+  struct list_head idle;
+  unsigned int nr_idle;
+  u16 port;
+};
+
+void vtfs_conn_pool_init(struct vtfs_conn_pool *pool, u16 port);
+void vtfs_conn_pool_destroy(struct vtfs_conn_pool *pool);
+
+// Take an idle connection or open a new one, *reused tells which
+struct vtfs_conn *vtfs_conn_get(struct vtfs_conn_pool *pool, bool *reused);
+// Give a healthy connection back, or close it if it is broken or not needed
+void vtfs_conn_put(struct vtfs_conn_pool *pool, struct vtfs_conn *conn,
+                   bool healthy);
+
+// Send head followed by the payload, which may be NULL and is left as it
+// is. Returns -ECONNRESET unless everything went out, *sent tells whether
+// anything did
+int vtfs_conn_send(struct vtfs_conn *conn, struct kvec *head,
+                   const struct iov_iter *payload, bool *sent);
+
+#endif // VTFS_CONN_POOL_H
@@ -1,4 +1,6 @@
+#include "buf_pool.h"
 #include "http.h"
+#include "http_parser.h"
 
 #include <linux/net.h>
 #include <linux/socket.h>
@@ -12,210 +14,299 @@
 #include <linux/init.h>
 #include <linux/netdevice.h>
 
-const char *SERVER_IP = "127.0.0.1"; // localhost
-const int SERVER_PORT = 8888;
+#define HTTP_TAIL " HTTP/1.1\r\nHost:" VTFS_SERVER_IP "\r\nConnection: keep-alive\r\n"
+#define HTTP_BODY_HEADERS \
+  "Content-Type: application/octet-stream\r\nContent-Length: %zu\r\n"
+
+// Build the request line and headers. A request with a body becomes a POST,
+// the body itself is sent separately. Caller gives vec->iov_base back to
+// vtfs_small_bufs with the *buf_size it was taken with
+int fill_request(struct kvec *vec, size_t *buf_size, const char *token,
+                 const char *method, size_t body_len, size_t arg_size,
+                 va_list args) {
+  const char *verb = body_len ? "POST" : "GET";
+
+  // First pass sizes the request, the query string has no fixed limit
+  size_t len = strlen(verb) + strlen(" /api/?token=") + strlen(method) +
+               strlen(token) + strlen(HTTP_TAIL) + strlen(HTTP_BODY_HEADERS) +
+               20 + strlen("\r\n");
+  va_list sizing;
+  va_copy(sizing, args);
+  for (size_t i = 0; i < arg_size; i++) {
+    len += strlen("&=") + strlen(va_arg(sizing, char *));
+    len += strlen(va_arg(sizing, char *));
+  }
+  va_end(sizing);
 
-// callee should call free_request on received buffer
-int fill_request(struct kvec *vec, const char *token, const char *method,
-                 size_t arg_size, va_list args) {
-  char *request_buffer = kzalloc(32 * 1024 + 64, GFP_KERNEL);
+  char *request_buffer = vtfs_buf_get(&vtfs_small_bufs, len + 1);
   if (request_buffer == 0) {
     return -ENOMEM;
   }
-
-  strcpy(request_buffer, "GET /api/");
-  strcat(request_buffer, method);
-
-  strcat(request_buffer, "?token=");
-  strcat(request_buffer, token);
-
-  for (int i = 0; i < arg_size; i++) {
-    strcat(request_buffer, "&");
-    strcat(request_buffer, va_arg(args, char *));
-    strcat(request_buffer, "=");
-    strcat(request_buffer, va_arg(args, char *));
+  *buf_size = len + 1;
+
+  char *p = request_buffer;
+  char *end = request_buffer + len + 1;
+  p += scnprintf(p, end - p, "%s /api/%s?token=%s", verb, method, token);
+  for (size_t i = 0; i < arg_size; i++) {
+    const char *name = va_arg(args, char *);
+    const char *value = va_arg(args, char *);
+    p += scnprintf(p, end - p, "&%s=%s", name, value);
   }
-
-  strcat(request_buffer, " HTTP/1.1\r\nHost:");
-  strcat(request_buffer, SERVER_IP);
-  strcat(request_buffer, "\r\nConnection: close\r\n\r\n");
+  p += scnprintf(p, end - p, HTTP_TAIL);
+  if (body_len) {
+    p += scnprintf(p, end - p, HTTP_BODY_HEADERS, body_len);
+  }
+  p += scnprintf(p, end - p, "\r\n");
 
   memset(vec, 0, sizeof(struct kvec));
   vec->iov_base = request_buffer;
-  vec->iov_len = strlen(request_buffer);
+  vec->iov_len = p - request_buffer;
 
   return 0;
 }
 
-int receive_all(struct socket *sock, char *buffer, size_t buffer_size) {
-  struct msghdr hdr;
-  struct kvec vec;
+// Where body bytes go: the int64 status first, then the data. The body of
+// an error reply is drained, so the connection stays usable
+struct body_sink {
+  __le64 status;
+  size_t got;  // Body bytes taken so far
+  struct iov_iter *dest;  // NULL to discard
+};
 
-  int read = 0;
+static bool sink_wants_status(const struct body_sink *sink) {
+  return sink->got < sizeof(sink->status);
+}
 
-  while (read < buffer_size) {
-    memset(&hdr, 0, sizeof(struct msghdr));
-    memset(&vec, 0, sizeof(struct kvec));
-    vec.iov_base = buffer + read;
-    vec.iov_len = buffer_size - read;
-    int ret = kernel_recvmsg(sock, &hdr, &vec, 1, vec.iov_len, 0);
-    if (ret == 0) {
-      break;
-    } else if (ret < 0) {
-      return -4;
-    }
-    read += ret;
+static int sink_take(struct body_sink *sink, const char *data, size_t len) {
+  if (sink_wants_status(sink)) {
+    size_t n = min(len, sizeof(sink->status) - sink->got);
+    memcpy((char *)&sink->status + sink->got, data, n);
+    sink->got += n;
+    data += n;
+    len -= n;
+  }
+  if (len == 0) {
+    return 0;
   }
 
-  return read;
+  sink->got += len;
+  if (sink->dest == NULL) {
+    return 0;
+  }
+  if (len > iov_iter_count(sink->dest)) {
+    return -ENOSPC;
+  }
+  return copy_to_iter(data, len, sink->dest) == len ? 0 : -EFAULT;
 }
 
-int64_t parse_http_response(char *raw_response, size_t raw_response_size,
-                            char *response, size_t response_size, size_t *data_len) {
-  char *buffer = raw_response;
+// Receive up to len body bytes straight into dest, skipping the buffer
+static int recv_body_direct(struct socket *sock, struct iov_iter *dest,
+                            size_t len) {
+  struct msghdr msg = {};
 
-  // Read Response Line
-  {
-    char *status_line = strsep(&buffer, "\r");
-    strsep(&status_line, " ");
-    if (status_line == 0) {
-      return -6;
-    }
-    char *status_code = strsep(&status_line, " ");
-    printk(KERN_INFO "Received response with status code %s\n", status_code);
-    if (strcmp(status_code, "200") != 0) {
-      return -5;
-    }
+  msg.msg_iter = *dest;
+  iov_iter_truncate(&msg.msg_iter, len);
+  int ret = sock_recvmsg(sock, &msg, 0);
+  if (ret > 0) {
+    iov_iter_advance(dest, ret);
   }
+  return ret;
+}
 
-  int length = -1;
-
-  while (true) {
-    if (buffer == 0) {
-      return -6;
+// Read one response, feeding socket data to the parser as it arrives. The
+// data after the int64 status goes into dest, large bodies straight off the
+// socket. Bytes past the end of the response are left in conn, one request
+// is in flight at a time so they can only be garbage.
+// Returns a transport error, after which the connection is unusable. Sets
+// *keep_alive to whether the server lets us reuse the connection
+static int receive_response(struct vtfs_conn *conn, struct iov_iter *dest,
+                            int64_t *status, size_t *data_len,
+                            bool *keep_alive) {
+  struct http_parser parser;
+  struct body_sink sink = {.dest = dest};
+  bool seen = false;  // Any byte of this response yet
+
+  http_parser_init(&parser);
+  *keep_alive = false;
+
+  while (!http_parser_done(&parser)) {
+    u64 body_left = http_parser_body_left(&parser);
+    size_t buffered = conn->rend - conn->rstart;
+    int ret;
+
+    if (body_left && parser.status != 200) {
+      sink.dest = NULL;
     }
-    char *header = strsep(&buffer, "\r");
-    ++header; // skip \n
-    if (strcmp(header, "") == 0) {
-      // end of headers
-      break;
+
+    if (body_left && buffered) {
+      size_t n = min_t(u64, body_left, buffered);
+      ret = sink_take(&sink, conn->rbuf + conn->rstart, n);
+      if (ret) {
+        return ret;
+      }
+      conn->rstart += n;
+      http_parser_body_done(&parser, n);
+      continue;
     }
 
-    if (strncmp(header, "Content-Length: ", 16) == 0) {
-      int error = kstrtoint(header + 16, 0, &length);
-      if (error != 0) {
-        return -6;
+    if (body_left && sink.dest && !sink_wants_status(&sink)) {
+      size_t room = iov_iter_count(sink.dest);
+      if (room == 0) {
+        return -ENOSPC;
+      }
+      ret = recv_body_direct(conn->sock, sink.dest, min_t(u64, body_left, room));
+      if (ret < 0) {
+        return -EIO;
       }
-      printk(KERN_INFO "Received response with content length %d\n", length);
+      if (ret == 0) {
+        if (http_parser_eof(&parser)) {
+          return -EIO;
+        }
+        continue;
+      }
+      sink.got += ret;
+      http_parser_body_done(&parser, ret);
+      continue;
     }
-  }
-  ++buffer; // skip last '\n'
 
-  if (length == -1) {
-    return -6;
-  }
+    if (buffered) {
+      ret = http_parser_feed(&parser, conn->rbuf + conn->rstart, buffered);
+      if (ret < 0) {
+        printk(KERN_ERR "Malformed HTTP response\n");
+        return -EPROTO;
+      }
+      conn->rstart += ret;
+      continue;
+    }
 
-  if (buffer + length > raw_response + raw_response_size) {
-    return -6;
+    // Out of input, refill the buffer
+    struct msghdr hdr = {};
+    struct kvec vec = {.iov_base = conn->rbuf, .iov_len = VTFS_CONN_RBUF};
+    conn->rstart = 0;
+    conn->rend = 0;
+    ret = kernel_recvmsg(conn->sock, &hdr, &vec, 1, vec.iov_len, 0);
+    if (ret < 0) {
+      return -EIO;
+    }
+    if (ret == 0) {
+      // Closed by the server. Before the first byte this is a stale idle connection
+      if (!seen) {
+        return -ECONNRESET;
+      }
+      if (http_parser_eof(&parser)) {
+        return -EIO;
+      }
+      continue;
+    }
+    conn->rend = ret;
+    seen = true;
   }
 
-  if (length < sizeof(int64_t)) {
-    return -7;
+  *keep_alive = parser.keep_alive;
+  if (parser.status != 200) {
+    printk(KERN_INFO "Received response with status code %d\n", parser.status);
+    // A server that doesn't know the method says so like the RPC one does,
+    // any other HTTP error is its own failure, not a status of the call
+    if (parser.status == 404 || parser.status == 501) {
+      *status = ENOSYS;
+    } else {
+      *status = -EREMOTEIO;
+    }
+    return 0;
   }
-
-  length -= sizeof(int64_t);
-
-  if (length > response_size) {
-    return -ENOSPC;
+  if (sink_wants_status(&sink)) {
+    *keep_alive = false;
+    return -EPROTO;
   }
 
-  int64_t return_value;
-  memcpy(&return_value, buffer, sizeof(int64_t));
-
-  buffer += sizeof(int64_t);
-  memcpy(response, buffer, length);
-
+  *status = le64_to_cpu(sink.status);
   if (data_len) {
-    *data_len = length;
+    *data_len = sink.got - sizeof(sink.status);
   }
-
-  return return_value;
+  return 0;
 }
 
-int64_t vtfs_http_call(const char *token, const char *method,
-                            char *response_buffer, size_t buffer_size,
-                            size_t *data_len, size_t arg_size, ...) {
-  struct socket *sock;
+int64_t vtfs_http_vcall_iter(struct vtfs_conn_pool *pool, const char *token,
+                             const char *method, bool idempotent,
+                             const struct iov_iter *body, struct iov_iter *dest,
+                             size_t *data_len, size_t arg_size, va_list args) {
   int64_t error;
 
-  error = sock_create_kern(&init_net, AF_INET, SOCK_STREAM, IPPROTO_TCP, &sock);
-  if (error < 0) {
-    return -1;
-  }
-
-  struct sockaddr_in s_addr = {.sin_family = AF_INET,
-                               .sin_addr = {.s_addr = in_aton(SERVER_IP)},
-                               .sin_port = htons(SERVER_PORT)};
-
-  error = kernel_connect(sock, (struct sockaddr *)&s_addr,
-                         sizeof(struct sockaddr_in), 0);
-  if (error != 0) {
-
-    sock_release(sock);
-    return -2;
-  }
-
-  struct kvec kvec;
-  va_list args;
-  va_start(args, arg_size);
-  error = fill_request(&kvec, token, method, arg_size, args);
-  va_end(args);
+  // The body is sent from the caller's iterator after the headers, not copied
+  struct kvec head;
+  size_t request_size;
+  size_t body_len = body ? iov_iter_count(body) : 0;
+  error = fill_request(&head, &request_size, token, method, body_len,
+                       arg_size, args);
 
   if (error != 0) {
-    kernel_sock_shutdown(sock, SHUT_RDWR);
-    sock_release(sock);
     return error;
   }
 
-  struct msghdr msg;
-  memset(&msg, 0, sizeof(struct msghdr));
-
-  error = kernel_sendmsg(sock, &msg, &kvec, 1, kvec.iov_len);
-  kfree(kvec.iov_base);
+  int64_t status = 0;
+  int ret;
+  bool reused;
+  bool sent;
+  bool keep_alive;
+  struct vtfs_conn *conn;
+  do {
+    conn = vtfs_conn_get(pool, &reused);
+    if (conn == NULL) {
+      vtfs_buf_put(&vtfs_small_bufs, head.iov_base, request_size);
+      return -ECONNREFUSED;
+    }
 
-  if (error < 0) {
-    kernel_sock_shutdown(sock, SHUT_RDWR);
-    sock_release(sock);
-    return -3;
-  }
+    ret = vtfs_conn_send(conn, &head, body, &sent);
+    if (ret == 0) {
+      ret = receive_response(conn, dest, &status, data_len, &keep_alive);
+    }
 
-  size_t raw_buffer_size = buffer_size + 1024; // add 1KB for HTTP headers
-  char *raw_response_buffer = kmalloc(raw_buffer_size, GFP_KERNEL);
-  if (raw_response_buffer == 0) {
-    kernel_sock_shutdown(sock, SHUT_RDWR);
-    sock_release(sock);
-    return -ENOMEM;
-  }
-  int read_bytes = receive_all(sock, raw_response_buffer, raw_buffer_size);
+    // A reply followed by more bytes leaves the stream out of step, the
+    // next request on it would read them as its response
+    vtfs_conn_put(pool, conn,
+                  ret == 0 && keep_alive && conn->rstart == conn->rend);
+    // The server may have dropped an idle connection, retry once on a new
+    // one. Nothing reached dest yet. But the server may also have run the
+    // request and closed before replying: only a request that is harmless
+    // to run twice, or never left, goes out again
+  } while (ret == -ECONNRESET && reused && (idempotent || !sent));
 
-  kernel_sock_shutdown(sock, SHUT_RDWR);
-  sock_release(sock);
+  vtfs_buf_put(&vtfs_small_bufs, head.iov_base, request_size);
 
-  if (read_bytes < 0) {
-    kfree(raw_response_buffer);
-    return -4;
+  if (ret < 0) {
+    return ret;
   }
+  return status;
+}
 
-  size_t actual_data_length = 0;
-  error = parse_http_response(raw_response_buffer, read_bytes, response_buffer,
-                              buffer_size, &actual_data_length);
-
-  if (data_len) {
-    *data_len = actual_data_length;
-  }
+int64_t vtfs_http_vcall(struct vtfs_conn_pool *pool, const char *token,
+                        const char *method, bool idempotent, const void *body,
+                        size_t body_len, char *response_buffer,
+                        size_t buffer_size, size_t *data_len, size_t arg_size,
+                        va_list args) {
+  struct kvec vec = {.iov_base = response_buffer, .iov_len = buffer_size};
+  struct kvec body_vec = {.iov_base = (void *)body, .iov_len = body_len};
+  struct iov_iter dest;
+  struct iov_iter source;
+
+  iov_iter_kvec(&dest, ITER_DEST, &vec, 1, buffer_size);
+  iov_iter_kvec(&source, ITER_SOURCE, &body_vec, 1, body_len);
+  return vtfs_http_vcall_iter(pool, token, method, idempotent, &source, &dest,
+                              data_len, arg_size, args);
+}
 
-  kfree(raw_response_buffer);
-  return error;
+int64_t vtfs_http_call(struct vtfs_conn_pool *pool, const char *token,
+                       const char *method, bool idempotent, const void *body,
+                       size_t body_len, char *response_buffer,
+                       size_t buffer_size, size_t *data_len, size_t arg_size,
+                       ...) {
+  va_list args;
+  va_start(args, arg_size);
+  int64_t ret = vtfs_http_vcall(pool, token, method, idempotent, body,
+                                body_len, response_buffer, buffer_size,
+                                data_len, arg_size, args);
+  va_end(args);
+  return ret;
 }
 
 void encode(const char *src, char *dst) {
@@ -2,10 +2,33 @@
 #define VTFS_HTTP_H
 
 #include <linux/inet.h>
+#include <linux/stdarg.h>
+#include <linux/uio.h>
 
-int64_t vtfs_http_call(const char *token, const char *method,
-                            char *response_buffer, size_t buffer_size,
-                            size_t *data_len, size_t arg_size, ...);
+#include "conn_pool.h"
+
+// Arguments are (name, value) string pairs for the query string. A non-empty
+// body turns the request into a POST carrying it raw. An idempotent request
+// is sent again when a reused connection dies before the reply; others only
+// when the server cannot have seen them. Returns the server's status, 0 or
+// a positive errno, or a negative errno when the exchange itself failed.
+// An unknown method is ENOSYS, any other HTTP error -EREMOTEIO
+int64_t vtfs_http_vcall(struct vtfs_conn_pool *pool, const char *token,
+                        const char *method, bool idempotent, const void *body,
+                        size_t body_len, char *response_buffer,
+                        size_t buffer_size, size_t *data_len, size_t arg_size,
+                        va_list args);
+// Same, with the body sent from an iterator, which is left as it is, and
+// the response data received straight into dest
+int64_t vtfs_http_vcall_iter(struct vtfs_conn_pool *pool, const char *token,
+                             const char *method, bool idempotent,
+                             const struct iov_iter *body, struct iov_iter *dest,
+                             size_t *data_len, size_t arg_size, va_list args);
+int64_t vtfs_http_call(struct vtfs_conn_pool *pool, const char *token,
+                       const char *method, bool idempotent, const void *body,
+                       size_t body_len, char *response_buffer,
+                       size_t buffer_size, size_t *data_len, size_t arg_size,
+                       ...);
 
 void encode(const char *, char *);
 
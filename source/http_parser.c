@@ -0,0 +1,183 @@
+#include "http_parser.h"
+
+#include <linux/ctype.h>
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/limits.h>
+#include <linux/string.h>
+
+void http_parser_init(struct http_parser *parser) {
+  memset(parser, 0, sizeof(*parser));
+  parser->state = HTTP_PARSE_STATUS;
+}
+
+// "HTTP/1.x NNN reason"
+static int parse_status_line(struct http_parser *parser, const char *line) {
+  if (strncmp(line, "HTTP/1.", 7) != 0 || !isdigit(line[7]) ||
+      line[8] != ' ') {
+    return -EBADMSG;
+  }
+  if (!isdigit(line[9]) || !isdigit(line[10]) || !isdigit(line[11]) ||
+      (line[12] != '\0' && line[12] != ' ')) {
+    return -EBADMSG;
+  }
+
+  parser->status =
+      (line[9] - '0') * 100 + (line[10] - '0') * 10 + (line[11] - '0');
+  // HTTP/1.1 connections persist unless told otherwise, 1.0 ones don't
+  parser->keep_alive = line[7] != '0';
+  parser->state = HTTP_PARSE_HEADERS;
+  return 0;
+}
+
+static int parse_header(struct http_parser *parser, char *line) {
+  char *value = strchr(line, ':');
+  if (value == NULL || value == line) {
+    return -EBADMSG;
+  }
+  *value++ = '\0';
+  value = strim(value);
+
+  if (strcasecmp(line, "Content-Length") == 0) {
+    u64 length;
+    if (kstrtou64(value, 10, &length) != 0) {
+      return -EBADMSG;
+    }
+    // Repeated lengths must agree
+    if (parser->has_length && parser->left != length) {
+      return -EBADMSG;
+    }
+    parser->has_length = true;
+    parser->left = length;
+  } else if (strcasecmp(line, "Transfer-Encoding") == 0) {
+    if (strcasecmp(value, "chunked") != 0) {
+      return -EBADMSG;
+    }
+    parser->chunked = true;
+  } else if (strcasecmp(line, "Connection") == 0) {
+    if (strcasecmp(value, "close") == 0) {
+      parser->keep_alive = false;
+    } else if (strcasecmp(value, "keep-alive") == 0) {
+      parser->keep_alive = true;
+    }
+  }
+  return 0;
+}
+
+// The empty line after the headers picks how the body is framed
+static int end_headers(struct http_parser *parser) {
+  if (parser->chunked && parser->has_length) {
+    return -EBADMSG;
+  }
+
+  if (parser->chunked) {
+    parser->state = HTTP_PARSE_CHUNK_SIZE;
+  } else if (parser->has_length) {
+    parser->state = parser->left ? HTTP_PARSE_BODY : HTTP_PARSE_DONE;
+  } else {
+    parser->until_close = true;
+    parser->keep_alive = false;
+    parser->left = U64_MAX;
+    parser->state = HTTP_PARSE_BODY;
+  }
+  return 0;
+}
+
+// Hex size, optionally followed by ";extension"
+static int parse_chunk_size(struct http_parser *parser, char *line) {
+  u64 size;
+
+  strreplace(line, ';', '\0');
+  if (kstrtou64(strim(line), 16, &size) != 0) {
+    return -EBADMSG;
+  }
+
+  parser->left = size;
+  parser->state = size ? HTTP_PARSE_CHUNK_DATA : HTTP_PARSE_TRAILERS;
+  return 0;
+}
+
+static int parse_line(struct http_parser *parser, char *line) {
+  switch (parser->state) {
+  case HTTP_PARSE_STATUS:
+    return parse_status_line(parser, line);
+  case HTTP_PARSE_HEADERS:
+    return *line ? parse_header(parser, line) : end_headers(parser);
+  case HTTP_PARSE_CHUNK_SIZE:
+    return parse_chunk_size(parser, line);
+  case HTTP_PARSE_CHUNK_END:
+    if (*line) {
+      return -EBADMSG;
+    }
+    parser->state = HTTP_PARSE_CHUNK_SIZE;
+    return 0;
+  case HTTP_PARSE_TRAILERS:
+    if (*line == '\0') {
+      parser->state = HTTP_PARSE_DONE;
+    } else if (strchr(line, ':') == NULL) {
+      return -EBADMSG;
+    }
+    return 0;
+  default:
+    return -EBADMSG;
+  }
+}
+
+int http_parser_feed(struct http_parser *parser, const char *data, size_t len) {
+  size_t used = 0;
+
+  while (used < len && !http_parser_done(parser) &&
+         !http_parser_body_left(parser)) {
+    char c = data[used++];
+
+    if (c != '\n') {
+      // Fail fast instead of buffering an endless line
+      if (parser->line_len == HTTP_LINE_MAX - 1 || c == '\0') {
+        return -EBADMSG;
+      }
+      parser->line[parser->line_len++] = c;
+      continue;
+    }
+
+    if (parser->line_len && parser->line[parser->line_len - 1] == '\r') {
+      parser->line_len--;
+    }
+    parser->line[parser->line_len] = '\0';
+    parser->line_len = 0;
+
+    int ret = parse_line(parser, parser->line);
+    if (ret) {
+      return ret;
+    }
+  }
+  return used;
+}
+
+u64 http_parser_body_left(const struct http_parser *parser) {
+  if (parser->state == HTTP_PARSE_BODY ||
+      parser->state == HTTP_PARSE_CHUNK_DATA) {
+    return parser->left;
+  }
+  return 0;
+}
+
+void http_parser_body_done(struct http_parser *parser, size_t len) {
+  if (parser->until_close) {
+    return;
+  }
+
+  parser->left -= len;
+  if (parser->left == 0) {
+    parser->state = parser->state == HTTP_PARSE_CHUNK_DATA
+                        ? HTTP_PARSE_CHUNK_END
+                        : HTTP_PARSE_DONE;
+  }
+}
+
+int http_parser_eof(struct http_parser *parser) {
+  if (parser->state == HTTP_PARSE_BODY && parser->until_close) {
+    parser->state = HTTP_PARSE_DONE;
+    return 0;
+  }
+  return -EBADMSG;
+}
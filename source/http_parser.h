@@ -0,0 +1,54 @@
+#ifndef VTFS_HTTP_PARSER_H
+#define VTFS_HTTP_PARSER_H
+
+#include <linux/types.h>
+
+// Longest status, header or chunk-size line accepted
+#define HTTP_LINE_MAX 1024
+
+enum http_parser_state {
+  HTTP_PARSE_STATUS,
+  HTTP_PARSE_HEADERS,
+  HTTP_PARSE_BODY,  // Framed by Content-Length or by close
+  HTTP_PARSE_CHUNK_SIZE,
+  HTTP_PARSE_CHUNK_DATA,
+  HTTP_PARSE_CHUNK_END,  // CRLF after chunk data
+  HTTP_PARSE_TRAILERS,
+  HTTP_PARSE_DONE,
+};
+
+// Incremental parser of one HTTP/1.x response. It consumes the framing
+// itself and leaves body bytes to the caller, who may take them from its
+// buffer or straight off the socket
+struct http_parser {
+  enum http_parser_state state;
+  int status;
+  bool keep_alive;
+  bool chunked;
+  bool has_length;
+  bool until_close;
+  u64 left;  // Body bytes left in the response or in the current chunk
+  size_t line_len;
+  char line[HTTP_LINE_MAX];
+};
+
+void http_parser_init(struct http_parser *parser);
+
+// Consume framing from data. Stops where body bytes are due and after the
+// end of the response, bytes after it stay unconsumed.
+// Returns the number of bytes consumed or -EBADMSG
+int http_parser_feed(struct http_parser *parser, const char *data, size_t len);
+
+// Body bytes the caller may take now, 0 while framing comes first
+u64 http_parser_body_left(const struct http_parser *parser);
+void http_parser_body_done(struct http_parser *parser, size_t len);
+
+// The peer closed the connection. Returns 0 if that ends a body framed by
+// close, -EBADMSG if the response is cut short
+int http_parser_eof(struct http_parser *parser);
+
+static inline bool http_parser_done(const struct http_parser *parser) {
+  return parser->state == HTTP_PARSE_DONE;
+}
+
+#endif // VTFS_HTTP_PARSER_H
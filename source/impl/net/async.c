@@ -0,0 +1,45 @@
+#include "async.h"
+
+#include <linux/errno.h>
+#include <linux/sched/mm.h>
+
+static void async_work(struct work_struct* work) {
+  struct vtfs_async_req* req = container_of(work, struct vtfs_async_req, work);
+
+  // Requests may carry writeback, the submitter's NOFS scope does not
+  // follow them here
+  unsigned int nofs = memalloc_nofs_save();
+  req->result = req->fn(req);
+  memalloc_nofs_restore(nofs);
+  complete(&req->done);
+}
+
+int vtfs_async_init(struct vtfs_async* async) {
+  // Workers sleep on the network, unbound keeps them off the submitting CPU.
+  // Writeback under memory pressure waits on them, keep a rescuer
+  async->wq = alloc_workqueue(
+      "vtfs_net", WQ_UNBOUND | WQ_MEM_RECLAIM, VTFS_ASYNC_MAX_INFLIGHT
+  );
+  if (!async->wq)
+    return -ENOMEM;
+  atomic64_set(&async->next_id, 0);
+  return 0;
+}
+
+void vtfs_async_destroy(struct vtfs_async* async) {
+  destroy_workqueue(async->wq);
+}
+
+void vtfs_async_submit(struct vtfs_async* async, struct vtfs_async_req* req, vtfs_async_fn fn) {
+  INIT_WORK(&req->work, async_work);
+  init_completion(&req->done);
+  req->fn = fn;
+  req->id = atomic64_inc_return(&async->next_id);
+  req->result = 0;
+  queue_work(async->wq, &req->work);
+}
+
+int64_t vtfs_async_wait(struct vtfs_async_req* req) {
+  wait_for_completion(&req->done);
+  return req->result;
+}
@@ -0,0 +1,40 @@
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#include <linux/atomic.h>
+#include <linux/completion.h>
+#include <linux/types.h>
+#include <linux/workqueue.h>
+
+// Requests a mount runs at once. Each holds its own pooled connection,
+// so this matches the pool's idle limit
+#define VTFS_ASYNC_MAX_INFLIGHT 8
+
+// Per-mount engine running server calls off the caller's task
+struct vtfs_async {
+  struct workqueue_struct* wq;
+  atomic64_t next_id;
+};
+
+struct vtfs_async_req;
+typedef int64_t (*vtfs_async_fn)(struct vtfs_async_req* req);
+
+// Embed in a request of your own and get it back with container_of in fn
+struct vtfs_async_req {
+  struct work_struct work;
+  struct completion done;
+  vtfs_async_fn fn;
+  u64 id;  // For logs, to tell concurrent requests apart
+  int64_t result;
+};
+
+int vtfs_async_init(struct vtfs_async* async);
+// Waits for everything still queued
+void vtfs_async_destroy(struct vtfs_async* async);
+
+// Run fn(req) on a worker. Every submitted request must be waited for
+void vtfs_async_submit(struct vtfs_async* async, struct vtfs_async_req* req, vtfs_async_fn fn);
+// Sleep until req has run and return what fn returned
+int64_t vtfs_async_wait(struct vtfs_async_req* req);
+
+#endif  // ASYNC_H
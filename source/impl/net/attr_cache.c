@@ -0,0 +1,142 @@
+#include "attr_cache.h"
+
+#include <linux/jiffies.h>
+#include <linux/slab.h>
+
+struct vtfs_attr_entry {
+  struct hlist_node hash;
+  vtfs_ino_t ino;
+  struct vtfs_node_meta meta;
+  unsigned int nlink;
+  bool meta_valid;
+  bool nlink_valid;
+  unsigned long meta_expires;
+  unsigned long nlink_expires;
+};
+
+void attr_cache_init(struct vtfs_attr_cache* cache) {
+  spin_lock_init(&cache->lock);
+  hash_init(cache->entries);
+}
+
+void attr_cache_destroy(struct vtfs_attr_cache* cache) {
+  struct vtfs_attr_entry* entry;
+  struct hlist_node* tmp;
+  int bkt;
+
+  hash_for_each_safe(cache->entries, bkt, tmp, entry, hash) {
+    hash_del(&entry->hash);
+    kfree(entry);
+  }
+}
+
+// Caller holds cache->lock
+static struct vtfs_attr_entry* find_entry(struct vtfs_attr_cache* cache, vtfs_ino_t ino) {
+  struct vtfs_attr_entry* entry;
+
+  hash_for_each_possible(cache->entries, entry, hash, ino) {
+    if (entry->ino == ino)
+      return entry;
+  }
+  return NULL;
+}
+
+// Find the entry of ino or add an empty one. Returns with cache->lock held,
+// or NULL without it if memory ran out
+static struct vtfs_attr_entry* get_entry(struct vtfs_attr_cache* cache, vtfs_ino_t ino) {
+  spin_lock(&cache->lock);
+  struct vtfs_attr_entry* entry = find_entry(cache, ino);
+  if (entry)
+    return entry;
+  spin_unlock(&cache->lock);
+
+  struct vtfs_attr_entry* fresh = kzalloc(sizeof(*fresh), GFP_KERNEL);
+  if (!fresh)
+    return NULL;
+  fresh->ino = ino;
+
+  // Somebody may have added it while we slept in the allocator
+  spin_lock(&cache->lock);
+  entry = find_entry(cache, ino);
+  if (entry) {
+    kfree(fresh);
+    return entry;
+  }
+  hash_add(cache->entries, &fresh->hash, ino);
+  return fresh;
+}
+
+void attr_cache_set_meta(
+    struct vtfs_attr_cache* cache, const struct vtfs_node_meta* meta, unsigned long ttl
+) {
+  if (!ttl)
+    return;
+
+  struct vtfs_attr_entry* entry = get_entry(cache, meta->ino);
+  if (!entry)
+    return;
+
+  entry->meta = *meta;
+  entry->meta_valid = true;
+  entry->meta_expires = jiffies + ttl;
+  spin_unlock(&cache->lock);
+}
+
+void attr_cache_set_nlink(
+    struct vtfs_attr_cache* cache, vtfs_ino_t ino, unsigned int nlink, unsigned long ttl
+) {
+  if (!ttl)
+    return;
+
+  struct vtfs_attr_entry* entry = get_entry(cache, ino);
+  if (!entry)
+    return;
+
+  entry->nlink = nlink;
+  entry->nlink_valid = true;
+  entry->nlink_expires = jiffies + ttl;
+  spin_unlock(&cache->lock);
+}
+
+void attr_cache_extend_size(struct vtfs_attr_cache* cache, vtfs_ino_t ino, loff_t size) {
+  spin_lock(&cache->lock);
+  struct vtfs_attr_entry* entry = find_entry(cache, ino);
+  if (entry && entry->meta_valid && size > entry->meta.size)
+    entry->meta.size = size;
+  spin_unlock(&cache->lock);
+}
+
+bool attr_cache_get_meta(struct vtfs_attr_cache* cache, vtfs_ino_t ino, struct vtfs_node_meta* out) {
+  bool hit = false;
+
+  spin_lock(&cache->lock);
+  struct vtfs_attr_entry* entry = find_entry(cache, ino);
+  if (entry && entry->meta_valid && time_before(jiffies, entry->meta_expires)) {
+    *out = entry->meta;
+    hit = true;
+  }
+  spin_unlock(&cache->lock);
+  return hit;
+}
+
+bool attr_cache_get_nlink(struct vtfs_attr_cache* cache, vtfs_ino_t ino, unsigned int* out) {
+  bool hit = false;
+
+  spin_lock(&cache->lock);
+  struct vtfs_attr_entry* entry = find_entry(cache, ino);
+  if (entry && entry->nlink_valid && time_before(jiffies, entry->nlink_expires)) {
+    *out = entry->nlink;
+    hit = true;
+  }
+  spin_unlock(&cache->lock);
+  return hit;
+}
+
+void attr_cache_forget(struct vtfs_attr_cache* cache, vtfs_ino_t ino) {
+  spin_lock(&cache->lock);
+  struct vtfs_attr_entry* entry = find_entry(cache, ino);
+  if (entry)
+    hash_del(&entry->hash);
+  spin_unlock(&cache->lock);
+  kfree(entry);
+}
@@ -0,0 +1,37 @@
+#ifndef ATTR_CACHE_H
+#define ATTR_CACHE_H
+
+#include <linux/hashtable.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include "../../vtfs_interface.h"
+
+#define ATTR_CACHE_BITS 10
+
+// Server attributes by ino. Metadata and link count are leased separately,
+// since they come from different calls
+struct vtfs_attr_cache {
+  spinlock_t lock;
+  DECLARE_HASHTABLE(entries, ATTR_CACHE_BITS);
+};
+
+void attr_cache_init(struct vtfs_attr_cache* cache);
+void attr_cache_destroy(struct vtfs_attr_cache* cache);
+
+// Remember fresh values for ttl jiffies, a zero ttl caches nothing
+void attr_cache_set_meta(
+    struct vtfs_attr_cache* cache, const struct vtfs_node_meta* meta, unsigned long ttl
+);
+void attr_cache_set_nlink(
+    struct vtfs_attr_cache* cache, vtfs_ino_t ino, unsigned int nlink, unsigned long ttl
+);
+// Our own write grew the file, keep a cached size in step
+void attr_cache_extend_size(struct vtfs_attr_cache* cache, vtfs_ino_t ino, loff_t size);
+
+// Return true and fill out if an unexpired value is cached
+bool attr_cache_get_meta(struct vtfs_attr_cache* cache, vtfs_ino_t ino, struct vtfs_node_meta* out);
+bool attr_cache_get_nlink(struct vtfs_attr_cache* cache, vtfs_ino_t ino, unsigned int* out);
+
+void attr_cache_forget(struct vtfs_attr_cache* cache, vtfs_ino_t ino);
+
+#endif  // ATTR_CACHE_H
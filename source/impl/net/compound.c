@@ -0,0 +1,127 @@
+#include "compound.h"
+#include "../../buf_pool.h"
+
+#include <linux/bug.h>
+#include <linux/err.h>
+#include <linux/errno.h>
+#include <linux/slab.h>
+#include <linux/stdarg.h>
+#include <linux/string.h>
+#include <linux/unaligned.h>
+
+void compound_init(struct compound* compound) {
+  compound->nops = 0;
+}
+
+struct compound_op* compound_add(struct compound* compound, const char* method, int nargs, ...) {
+  if (WARN_ON(compound->nops == COMPOUND_MAX_OPS || nargs > COMPOUND_MAX_ARGS))
+    return NULL;
+
+  struct compound_op* op = &compound->ops[compound->nops++];
+  va_list args;
+
+  op->method = method;
+  op->nargs = nargs;
+  va_start(args, nargs);
+  for (int i = 0; i < nargs; i++) {
+    op->args[i].name = va_arg(args, const char*);
+    op->args[i].value = va_arg(args, const char*);
+    op->args[i].flags = 0;
+  }
+  va_end(args);
+
+  op->status = -ECANCELED;
+  op->data = NULL;
+  op->data_len = 0;
+  return op;
+}
+
+int compound_add_prev_ino(struct compound_op* op, const char* name) {
+  if (WARN_ON(op->nargs == COMPOUND_MAX_ARGS))
+    return -E2BIG;
+
+  struct compound_arg* arg = &op->args[op->nargs++];
+  arg->name = name;
+  arg->value = "";
+  arg->flags = COMPOUND_ARG_PREV_INO;
+  return 0;
+}
+
+void* compound_encode(const struct compound* compound, size_t* len) {
+  // First pass sizes the body
+  size_t size = 2;
+  for (int i = 0; i < compound->nops; i++) {
+    const struct compound_op* op = &compound->ops[i];
+    size_t method_len = strlen(op->method);
+    if (method_len > U8_MAX)
+      return ERR_PTR(-ENAMETOOLONG);
+    size += 1 + method_len + 2;
+
+    for (int j = 0; j < op->nargs; j++) {
+      size_t name_len = strlen(op->args[j].name);
+      size_t value_len = strlen(op->args[j].value);
+      if (name_len > U8_MAX || value_len > U16_MAX)
+        return ERR_PTR(-E2BIG);
+      size += 1 + 1 + name_len + 2 + value_len;
+    }
+  }
+
+  char* body = vtfs_buf_get(&vtfs_small_bufs, size);
+  if (!body)
+    return ERR_PTR(-ENOMEM);
+
+  char* p = body;
+  put_unaligned_le16(compound->nops, p);
+  p += 2;
+  for (int i = 0; i < compound->nops; i++) {
+    const struct compound_op* op = &compound->ops[i];
+    size_t method_len = strlen(op->method);
+
+    *p++ = method_len;
+    memcpy(p, op->method, method_len);
+    p += method_len;
+    put_unaligned_le16(op->nargs, p);
+    p += 2;
+
+    for (int j = 0; j < op->nargs; j++) {
+      const struct compound_arg* arg = &op->args[j];
+      size_t name_len = strlen(arg->name);
+      size_t value_len = strlen(arg->value);
+
+      *p++ = arg->flags;
+      *p++ = name_len;
+      memcpy(p, arg->name, name_len);
+      p += name_len;
+      put_unaligned_le16(value_len, p);
+      p += 2;
+      memcpy(p, arg->value, value_len);
+      p += value_len;
+    }
+  }
+
+  *len = size;
+  return body;
+}
+
+int compound_decode(struct compound* compound, const char* data, size_t len) {
+  const char* end = data + len;
+
+  for (int i = 0; i < compound->nops && data < end; i++) {
+    struct compound_op* op = &compound->ops[i];
+
+    if (end - data < 12)
+      return -EPROTO;
+    op->status = (int64_t)get_unaligned_le64(data);
+    op->data_len = get_unaligned_le32(data + 8);
+    data += 12;
+
+    if ((size_t)(end - data) < op->data_len)
+      return -EPROTO;
+    op->data = data;
+    data += op->data_len;
+
+    if (op->status != 0)
+      break;
+  }
+  return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef COMPOUND_H
+#define COMPOUND_H
+
+#include <linux/types.h>
+
+#define COMPOUND_MAX_OPS 4
+#define COMPOUND_MAX_ARGS 4
+
+// Argument flag: the value is the ino of the NodeMeta returned by the
+// previous op, like the current filehandle of an NFSv4 COMPOUND
+#define COMPOUND_ARG_PREV_INO (1 << 0)
+
+// Several server calls sent as one "compound" request. The server runs them
+// in order and stops at the first one that fails.
+//
+// Body:  __le16 nops, nops * {u8 method_len, method, __le16 nargs,
+//        nargs * {u8 flags, u8 name_len, name, __le16 value_len, value}}
+// Reply: one {__le64 status, __le32 data_len, data} per op that ran
+struct compound_arg {
+  const char* name;
+  const char* value;  // Empty for COMPOUND_ARG_PREV_INO
+  u8 flags;
+};
+
+struct compound_op {
+  const char* method;
+  int nargs;
+  struct compound_arg args[COMPOUND_MAX_ARGS];
+  // Filled by compound_decode, data points into the reply buffer
+  int64_t status;
+  const char* data;
+  size_t data_len;
+};
+
+struct compound {
+  int nops;
+  struct compound_op ops[COMPOUND_MAX_OPS];
+};
+
+void compound_init(struct compound* compound);
+// Append an op with nargs (name, value) string pairs, which must outlive the call
+struct compound_op* compound_add(struct compound* compound, const char* method, int nargs, ...);
+// Append argument name to op, taking its value from the previous op's result
+int compound_add_prev_ino(struct compound_op* op, const char* name);
+
+// Returns a body of *len bytes taken from vtfs_small_bufs or an ERR_PTR
+void* compound_encode(const struct compound* compound, size_t* len);
+// Ops the server did not get to are left with status -ECANCELED
+int compound_decode(struct compound* compound, const char* data, size_t len);
+
+#endif  // COMPOUND_H
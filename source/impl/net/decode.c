@@ -37,6 +37,8 @@ int parse_node_meta(const char* data, struct vtfs_node_meta* out) {
   memcpy(&size_le, data, sizeof(size_le));
   out->size = le64_to_cpu(size_le);
 
+  out->nlink = 0; // Сервер не передает nlink в NodeMeta
+
   return 0;
 }
 
@@ -63,3 +65,17 @@ int parse_dirent(const char* data, struct vtfs_dirent* out) {
   return 0;
 }
 
+int parse_dirent_plus(const char* data, struct vtfs_dirent_plus* out) {
+  parse_dirent(data, &out->dirent);
+  data += DIRENT_SIZE;
+
+  parse_node_meta(data, &out->meta);
+  data += NODE_META_SIZE;
+
+  // Парсим nlink (uint32, little-endian)
+  __le32 nlink_le;
+  memcpy(&nlink_le, data, sizeof(nlink_le));
+  out->meta.nlink = le32_to_cpu(nlink_le);
+
+  return 0;
+}
@@ -12,5 +12,13 @@ int parse_node_meta(const char* data, struct vtfs_node_meta* out);
 // Формат: name (char[256]) + ino (int64, 8) + type (int16, 2) = 266 байт
 int parse_dirent(const char* data, struct vtfs_dirent* out);
 
+#define NODE_META_SIZE 30
+#define DIRENT_SIZE 266
+#define DIRENT_PLUS_SIZE (DIRENT_SIZE + NODE_META_SIZE + 4)
+
+// Парсинг записи iterate_dir_plus
+// Формат: Dirent (266 байт) + NodeMeta (30 байт) + nlink (uint32, 4) = 300 байт
+int parse_dirent_plus(const char* data, struct vtfs_dirent_plus* out);
+
 #endif // DECODE_H
 
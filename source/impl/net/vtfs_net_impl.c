@@ -3,23 +3,203 @@
 #include <linux/string.h>
 #include <linux/byteorder/generic.h>
 #include <linux/printk.h>
+#include <linux/stdarg.h>
 #include <linux/types.h>
-#include <linux/uaccess.h>
+#include <linux/uio.h>
+#include <linux/mm.h>
 #include <asm/byteorder.h>
 
 #include "../../vtfs_interface.h"
+#include "../../buf_pool.h"
 #include "../../http.h"
-#include "base64.h"
+#include "../../rpc.h"
+#include "async.h"
+#include "attr_cache.h"
+#include "compound.h"
 #include "decode.h"
 
 #define MAX_TOKEN_LEN 256
+// Largest read or write a single request carries, one pooled buffer
+#define NET_IO_CHUNK VTFS_LARGE_BUF_SIZE
 
 struct vtfs_net_storage {
   char token[MAX_TOKEN_LEN];
+  enum vtfs_net_proto proto;
+  struct vtfs_conn_pool pool;
+  struct vtfs_attr_cache attrs;
+  struct vtfs_async async;
+  bool no_compound;  // The server rejected "compound", its ops go one by one
+  bool no_readdir_plus;  // The server rejected "iterate_dir_plus"
 };
 
 static struct vtfs_net_storage* get_storage(struct super_block* sb) {
-  return (struct vtfs_net_storage*)sb->s_fs_info;
+  return (struct vtfs_net_storage*)VTFS_SB(sb)->storage;
+}
+
+// Calls that only read. Sending one twice, when a connection dies before
+// the reply, does no harm
+static bool net_idempotent(const char* method) {
+  static const char* const methods[] = {
+      "get_root", "lookup", "iterate_dir", "iterate_dir_plus", "count_links", "read",
+  };
+
+  for (size_t i = 0; i < ARRAY_SIZE(methods); i++) {
+    if (strcmp(method, methods[i]) == 0)
+      return true;
+  }
+  return false;
+}
+
+// Calls return the server's status, 0 or a positive errno, or a negative
+// errno of the transport. Callers hand errors up negative
+static int net_errno(int64_t result) {
+  return result > 0 ? -(int)result : (int)result;
+}
+
+// Call method on the server over the transport chosen at mount time.
+// Arguments are (name, value) string pairs, the payload, if any, travels
+// raw from its iterator and the response data is received straight into dest
+static int64_t net_vcall(
+    struct vtfs_net_storage* storage,
+    const char* method,
+    bool idempotent,
+    const struct iov_iter* payload,
+    struct iov_iter* dest,
+    size_t* data_len,
+    size_t arg_size,
+    va_list args
+) {
+  if (storage->proto == VTFS_PROTO_RPC) {
+    return vtfs_rpc_vcall_iter(
+        &storage->pool, storage->token, method, idempotent, payload, dest, data_len, arg_size,
+        args
+    );
+  }
+  return vtfs_http_vcall_iter(
+      &storage->pool, storage->token, method, idempotent, payload, dest, data_len, arg_size,
+      args
+  );
+}
+
+static int64_t net_call(
+    struct vtfs_net_storage* storage,
+    const char* method,
+    char* response_buffer,
+    size_t buffer_size,
+    size_t* data_len,
+    size_t arg_size,
+    ...
+) {
+  struct kvec vec = {.iov_base = response_buffer, .iov_len = buffer_size};
+  struct iov_iter dest;
+  va_list args;
+
+  iov_iter_kvec(&dest, ITER_DEST, &vec, 1, buffer_size);
+  va_start(args, arg_size);
+  int64_t ret = net_vcall(
+      storage, method, net_idempotent(method), NULL, &dest, data_len, arg_size, args
+  );
+  va_end(args);
+  return ret;
+}
+
+static int64_t net_call_iter(
+    struct vtfs_net_storage* storage,
+    const char* method,
+    struct iov_iter* dest,
+    size_t* data_len,
+    size_t arg_size,
+    ...
+) {
+  va_list args;
+  va_start(args, arg_size);
+  int64_t ret = net_vcall(
+      storage, method, net_idempotent(method), NULL, dest, data_len, arg_size, args
+  );
+  va_end(args);
+  return ret;
+}
+
+// Whether the call is idempotent depends on the payload, the caller knows
+static int64_t net_call_payload(
+    struct vtfs_net_storage* storage,
+    const char* method,
+    bool idempotent,
+    const struct iov_iter* payload,
+    char* response_buffer,
+    size_t buffer_size,
+    size_t* data_len,
+    size_t arg_size,
+    ...
+) {
+  struct kvec vec = {.iov_base = response_buffer, .iov_len = buffer_size};
+  struct iov_iter dest;
+  va_list args;
+
+  iov_iter_kvec(&dest, ITER_DEST, &vec, 1, buffer_size);
+  va_start(args, arg_size);
+  int64_t ret = net_vcall(
+      storage, method, idempotent, payload, &dest, data_len, arg_size, args
+  );
+  va_end(args);
+  return ret;
+}
+
+// Run all ops of compound in one round trip. Returns a transport error, or
+// -EOPNOTSUPP if the server has no compound. The outcome of each op is in
+// its status
+static int net_compound(
+    struct vtfs_net_storage* storage,
+    struct compound* compound,
+    char* response_buffer,
+    size_t buffer_size
+) {
+  size_t body_len;
+  void* body = compound_encode(compound, &body_len);
+  if (IS_ERR(body))
+    return PTR_ERR(body);
+
+  bool idempotent = true;
+  for (int i = 0; i < compound->nops; i++)
+    idempotent &= net_idempotent(compound->ops[i].method);
+
+  struct kvec vec = {.iov_base = body, .iov_len = body_len};
+  struct iov_iter payload;
+  iov_iter_kvec(&payload, ITER_SOURCE, &vec, 1, body_len);
+
+  size_t data_length = 0;
+  int64_t result = net_call_payload(
+      storage, "compound", idempotent, &payload, response_buffer, buffer_size, &data_length, 0
+  );
+  vtfs_buf_put(&vtfs_small_bufs, body, body_len);
+
+  // An older server answers ENOSYS, it doesn't know the method. Stop
+  // asking, the callers fall back to separate calls. Any other failure may
+  // be transient and only fails this call
+  if (result == ENOSYS) {
+    if (!READ_ONCE(storage->no_compound))
+      printk(KERN_INFO "[vtfs_net] Server has no compound, sending calls separately\n");
+    WRITE_ONCE(storage->no_compound, true);
+    return -EOPNOTSUPP;
+  }
+  if (result != 0) {
+    printk(KERN_ERR "[vtfs_net] Server compound failed with code: %lld\n", (long long)result);
+    return net_errno(result);
+  }
+  return compound_decode(compound, response_buffer, data_length);
+}
+
+// Names go raw over RPC, but must be percent-encoded in a URL
+static const char* wire_name(struct vtfs_net_storage* storage, const char* name, char* buffer) {
+  if (storage->proto == VTFS_PROTO_RPC)
+    return name;
+  encode(name, buffer);
+  return buffer;
+}
+
+// How long attributes fetched from the server are trusted
+static unsigned long attr_ttl(struct super_block* sb) {
+  return VTFS_SB(sb)->attr_ttl;
 }
 
 static int vtfs_net_storage_init(struct super_block* sb, const char* token) {
@@ -43,13 +223,23 @@ static int vtfs_net_storage_init(struct super_block* sb, const char* token) {
 
   strncpy(storage->token, token, MAX_TOKEN_LEN - 1);
   storage->token[MAX_TOKEN_LEN - 1] = '\0';
+  storage->proto = VTFS_SB(sb)->proto;
+  vtfs_conn_pool_init(
+      &storage->pool, storage->proto == VTFS_PROTO_RPC ? VTFS_RPC_PORT : VTFS_HTTP_PORT
+  );
+  attr_cache_init(&storage->attrs);
+  int error = vtfs_async_init(&storage->async);
+  if (error) {
+    kfree(storage);
+    return error;
+  }
 
-  sb->s_fs_info = storage;
+  VTFS_SB(sb)->storage = storage;
 
   char response_buffer[1024];
   memset(response_buffer, 0, sizeof(response_buffer));
   
-  int64_t result = vtfs_http_call(storage->token, "init", response_buffer, sizeof(response_buffer), NULL, 0);
+  int64_t result = net_call(storage, "init", response_buffer, sizeof(response_buffer), NULL, 0);
 
   if (result != 0) {
     // File system alrady exists, but is's okay
@@ -57,13 +247,12 @@ static int vtfs_net_storage_init(struct super_block* sb, const char* token) {
       printk(KERN_INFO "[vtfs_net] Filesystem already exists on server (token: %s), continuing\n", storage->token);
     } else {
       printk(KERN_ERR "[vtfs_net] Server init failed with code: %lld\n", (long long)result);
+      vtfs_async_destroy(&storage->async);
+      vtfs_conn_pool_destroy(&storage->pool);
       kfree(storage);
-      sb->s_fs_info = NULL;
+      VTFS_SB(sb)->storage = NULL;
       
-      if (result > 0) {
-        return (int)result;
-      }
-      return (int)result;
+      return net_errno(result);
     }
   }
 
@@ -74,8 +263,11 @@ static int vtfs_net_storage_init(struct super_block* sb, const char* token) {
 static void vtfs_net_storage_shutdown(struct super_block* sb) {
   struct vtfs_net_storage* storage = get_storage(sb);
   if (storage) {
+    vtfs_async_destroy(&storage->async);
+    attr_cache_destroy(&storage->attrs);
+    vtfs_conn_pool_destroy(&storage->pool);
     kfree(storage);
-    sb->s_fs_info = NULL;
+    VTFS_SB(sb)->storage = NULL;
   }
 }
 
@@ -89,14 +281,11 @@ static int vtfs_net_storage_get_root(struct super_block* sb, struct vtfs_node_me
   char response_buffer[1024];
   memset(response_buffer, 0, sizeof(response_buffer));
   
-  int64_t result = vtfs_http_call(storage->token, "get_root", response_buffer, sizeof(response_buffer), NULL, 0);
+  int64_t result = net_call(storage, "get_root", response_buffer, sizeof(response_buffer), NULL, 0);
 
   if (result != 0) {
     printk(KERN_ERR "[vtfs_net] Server get_root failed with code: %lld\n", (long long)result);
-    if (result > 0) {
-      return (int)result;
-    }
-    return (int)result;
+    return net_errno(result);
   }
 
   int parse_result = parse_node_meta(response_buffer, out);
@@ -105,9 +294,66 @@ static int vtfs_net_storage_get_root(struct super_block* sb, struct vtfs_node_me
     return parse_result;
   }
 
+  attr_cache_set_meta(&storage->attrs, out, attr_ttl(sb));
+  return 0;
+}
+
+// Take the NodeMeta of a successful lookup
+static int lookup_done(
+    struct super_block* sb, const char* data, size_t data_len, struct vtfs_node_meta* out
+) {
+  if (data_len < NODE_META_SIZE) {
+    printk(KERN_ERR "[vtfs_net] Lookup response too small: %zu\n", data_len);
+    return -EPROTO;
+  }
+  int parse_result = parse_node_meta(data, out);
+  if (parse_result != 0) {
+    printk(KERN_ERR "[vtfs_net] Failed to parse NodeMeta from lookup response: %d\n", parse_result);
+    return parse_result;
+  }
+  attr_cache_set_meta(&get_storage(sb)->attrs, out, attr_ttl(sb));
   return 0;
 }
 
+static int lookup_failed(int64_t result) {
+  if (result == ENOENT) {
+    return -ENOENT;
+  }
+  printk(KERN_ERR "[vtfs_net] Server lookup failed with code: %lld\n", (long long)result);
+  return net_errno(result);
+}
+
+// Plain lookup for servers without compound. The link count is left
+// unreported, count_links fetches it when the inode needs it
+static int lookup_single(
+    struct super_block* sb, vtfs_ino_t parent, const char* name, struct vtfs_node_meta* out
+) {
+  struct vtfs_net_storage* storage = get_storage(sb);
+  char encoded_name[NAME_MAX * 3 + 1];
+  char parent_str[32];
+  const char* wire = wire_name(storage, name, encoded_name);
+  snprintf(parent_str, sizeof(parent_str), "%llu", (unsigned long long)parent);
+
+  char response_buffer[1024];
+  memset(response_buffer, 0, sizeof(response_buffer));
+
+  size_t data_length = 0;
+  int64_t result = net_call(
+      storage,
+      "lookup",
+      response_buffer,
+      sizeof(response_buffer),
+      &data_length,
+      2,  // 2 args
+      "parent", parent_str,
+      "name", wire
+  );
+  if (result != 0)
+    return lookup_failed(result);
+
+  return lookup_done(sb, response_buffer, data_length, out);
+}
+
 static int vtfs_net_storage_lookup(
     struct super_block* sb, vtfs_ino_t parent, const char* name, struct vtfs_node_meta* out
 ) {
@@ -122,42 +368,43 @@ static int vtfs_net_storage_lookup(
     return -EINVAL;
   }
 
-  char encoded_name[NAME_MAX * 3 + 1];
+  if (READ_ONCE(storage->no_compound))
+    return lookup_single(sb, parent, name, out);
+
   char parent_str[32];
-  encode(name, encoded_name);
   snprintf(parent_str, sizeof(parent_str), "%llu", (unsigned long long)parent);
 
+  // Fetch the link count along, building the inode needs it next. Compound
+  // arguments travel in a binary body, so the name needs no encoding
+  struct compound compound;
+  compound_init(&compound);
+  struct compound_op* lookup = compound_add(&compound, "lookup", 2, "parent", parent_str, "name", name);
+  struct compound_op* count_links = compound_add(&compound, "count_links", 0);
+  compound_add_prev_ino(count_links, "ino");
+
   char response_buffer[1024];
   memset(response_buffer, 0, sizeof(response_buffer));
-  
-  int64_t result = vtfs_http_call(
-      storage->token, 
-      "lookup", 
-      response_buffer, 
-      sizeof(response_buffer),
-      NULL,
-      2,  // 2 args
-      "parent", parent_str,
-      "name", encoded_name
-  );
 
-  if (result != 0) {
-    if (result == ENOENT) {
-      return -ENOENT;
-    }
-    printk(KERN_ERR "[vtfs_net] Server lookup failed with code: %lld\n", (long long)result);
-    if (result > 0) {
-      return (int)result;
-    }
-    return (int)result;
+  int error = net_compound(storage, &compound, response_buffer, sizeof(response_buffer));
+  if (error == -EOPNOTSUPP)
+    return lookup_single(sb, parent, name, out);
+  if (error)
+    return error;
+
+  if (lookup->status != 0)
+    return lookup_failed(lookup->status);
+
+  error = lookup_done(sb, lookup->data, lookup->data_len, out);
+  if (error)
+    return error;
+
+  // Directories have no link count on the server, that failure is expected
+  if (count_links->status == 0 && count_links->data_len >= sizeof(__le32)) {
+    __le32 count_le;
+    memcpy(&count_le, count_links->data, sizeof(count_le));
+    out->nlink = le32_to_cpu(count_le);
+    attr_cache_set_nlink(&storage->attrs, out->ino, out->nlink, attr_ttl(sb));
   }
-
-  int parse_result = parse_node_meta(response_buffer, out);
-  if (parse_result != 0) {
-    printk(KERN_ERR "[vtfs_net] Failed to parse NodeMeta from lookup response: %d\n", parse_result);
-    return parse_result;
-  }
-
   return 0;
 }
 
@@ -183,8 +430,8 @@ static int vtfs_net_storage_iterate_dir(
   char response_buffer[1024];
   memset(response_buffer, 0, sizeof(response_buffer));
   
-  int64_t result = vtfs_http_call(
-      storage->token,
+  int64_t result = net_call(
+      storage,
       "iterate_dir",
       response_buffer,
       sizeof(response_buffer),
@@ -199,10 +446,7 @@ static int vtfs_net_storage_iterate_dir(
       return -ENOENT;
     }
     printk(KERN_ERR "[vtfs_net] Server iterate_dir failed with code: %lld\n", (long long)result);
-    if (result > 0) {
-      return (int)result;
-    }
-    return (int)result;
+    return net_errno(result);
   }
 
   int parse_result = parse_dirent(response_buffer, out);
@@ -216,6 +460,98 @@ static int vtfs_net_storage_iterate_dir(
   return 0;
 }
 
+static int vtfs_net_storage_iterate_dir_plus(
+    struct super_block* sb,
+    vtfs_ino_t dir_ino,
+    unsigned long* offset,
+    struct vtfs_dirent_plus* out,
+    int max
+) {
+  struct vtfs_net_storage* storage = get_storage(sb);
+  if (!storage) {
+    printk(KERN_ERR "[vtfs_net] Storage not initialized\n");
+    return -EINVAL;
+  }
+
+  if (!offset || !out || max <= 0) {
+    printk(KERN_ERR "[vtfs_net] Invalid arguments to iterate_dir_plus\n");
+    return -EINVAL;
+  }
+
+  if (READ_ONCE(storage->no_readdir_plus))
+    return -EOPNOTSUPP;
+
+  char dir_ino_str[32];
+  char offset_str[32];
+  char count_str[32];
+  snprintf(dir_ino_str, sizeof(dir_ino_str), "%llu", (unsigned long long)dir_ino);
+  snprintf(offset_str, sizeof(offset_str), "%lu", *offset);
+  snprintf(count_str, sizeof(count_str), "%d", max);
+
+  // u32 count, then count fixed-size records
+  size_t response_buffer_size = sizeof(__le32) + (size_t)max * DIRENT_PLUS_SIZE;
+  // Sized by the caller's batch, mostly far below a large pooled buffer
+  char* response_buffer = kvmalloc(response_buffer_size, GFP_KERNEL);
+  if (!response_buffer)
+    return -ENOMEM;
+
+  size_t data_length = 0;
+  int64_t result = net_call(
+      storage,
+      "iterate_dir_plus",
+      response_buffer,
+      response_buffer_size,
+      &data_length,
+      3,  // 3 args
+      "dir_ino", dir_ino_str,
+      "offset", offset_str,
+      "count", count_str
+  );
+
+  if (result != 0) {
+    kvfree(response_buffer);
+    if (result == ENOENT) {
+      return 0;
+    }
+    // An older server, directories are listed with iterate_dir from now on
+    if (result == ENOSYS) {
+      if (!READ_ONCE(storage->no_readdir_plus))
+        printk(KERN_INFO "[vtfs_net] Server has no iterate_dir_plus, listing without attributes\n");
+      WRITE_ONCE(storage->no_readdir_plus, true);
+      return -EOPNOTSUPP;
+    }
+    printk(KERN_ERR "[vtfs_net] Server iterate_dir_plus failed with code: %lld\n", (long long)result);
+    return net_errno(result);
+  }
+
+  __le32 count_le;
+  u32 count = 0;
+  if (data_length >= sizeof(count_le)) {
+    memcpy(&count_le, response_buffer, sizeof(count_le));
+    count = le32_to_cpu(count_le);
+  }
+  if (data_length < sizeof(count_le) || count > max ||
+      data_length < sizeof(count_le) + (size_t)count * DIRENT_PLUS_SIZE) {
+    printk(KERN_ERR "[vtfs_net] Malformed iterate_dir_plus response of %zu bytes\n", data_length);
+    kvfree(response_buffer);
+    return -EPROTO;
+  }
+
+  // Whoever lists the directory stats its entries next, serve them locally
+  const char* record = response_buffer + sizeof(count_le);
+  for (u32 i = 0; i < count; i++, record += DIRENT_PLUS_SIZE) {
+    parse_dirent_plus(record, &out[i]);
+    out[i].offset = *offset + i + 1;
+    attr_cache_set_meta(&storage->attrs, &out[i].meta, attr_ttl(sb));
+    if (out[i].meta.type == VTFS_NODE_FILE)
+      attr_cache_set_nlink(&storage->attrs, out[i].meta.ino, out[i].meta.nlink, attr_ttl(sb));
+  }
+  *offset += count;
+
+  kvfree(response_buffer);
+  return count;
+}
+
 static int vtfs_net_storage_create_file(
     struct super_block* sb,
     vtfs_ino_t parent,
@@ -239,31 +575,28 @@ static int vtfs_net_storage_create_file(
   char encoded_name[NAME_MAX * 3 + 1];
   char parent_str[32];
   char mode_str[32];
-  encode(name, encoded_name);
+  const char* wire = wire_name(storage, name, encoded_name);
   snprintf(parent_str, sizeof(parent_str), "%llu", (unsigned long long)parent);
   snprintf(mode_str, sizeof(mode_str), "%u", (unsigned int)permissions);
 
   char response_buffer[1024];
   memset(response_buffer, 0, sizeof(response_buffer));
   
-  int64_t result = vtfs_http_call(
-      storage->token,
+  int64_t result = net_call(
+      storage,
       "create_file",
       response_buffer,
       sizeof(response_buffer),
       NULL,
       3,  // 3 args
       "parent", parent_str,
-      "name", encoded_name,
+      "name", wire,
       "mode", mode_str
   );
 
   if (result != 0) {
     printk(KERN_ERR "[vtfs_net] Server create_file failed with code: %lld\n", (long long)result);
-    if (result > 0) {
-      return (int)result;
-    }
-    return (int)result;
+    return net_errno(result);
   }
 
   int parse_result = parse_node_meta(response_buffer, out);
@@ -272,6 +605,9 @@ static int vtfs_net_storage_create_file(
     return parse_result;
   }
 
+  out->nlink = 1;
+  attr_cache_set_meta(&storage->attrs, out, attr_ttl(sb));
+  attr_cache_set_nlink(&storage->attrs, out->ino, 1, attr_ttl(sb));
   return 0;
 }
 
@@ -289,29 +625,26 @@ static int vtfs_net_storage_unlink(struct super_block* sb, vtfs_ino_t parent, co
 
   char encoded_name[NAME_MAX * 3 + 1];
   char parent_str[32];
-  encode(name, encoded_name);
+  const char* wire = wire_name(storage, name, encoded_name);
   snprintf(parent_str, sizeof(parent_str), "%llu", (unsigned long long)parent);
 
   char response_buffer[1024];
   memset(response_buffer, 0, sizeof(response_buffer));
   
-  int64_t result = vtfs_http_call(
-      storage->token,
+  int64_t result = net_call(
+      storage,
       "unlink",
       response_buffer,
       sizeof(response_buffer),
       NULL,
       2,  // 2 args
       "parent", parent_str,
-      "name", encoded_name
+      "name", wire
   );
 
   if (result != 0) {
     printk(KERN_ERR "[vtfs_net] Server unlink failed with code: %lld\n", (long long)result);
-    if (result > 0) {
-      return (int)result;
-    }
-    return (int)result;
+    return net_errno(result);
   }
 
   return 0;
@@ -340,31 +673,28 @@ static int vtfs_net_storage_create_dir(
   char encoded_name[NAME_MAX * 3 + 1];
   char parent_str[32];
   char mode_str[32];
-  encode(name, encoded_name);
+  const char* wire = wire_name(storage, name, encoded_name);
   snprintf(parent_str, sizeof(parent_str), "%llu", (unsigned long long)parent);
   snprintf(mode_str, sizeof(mode_str), "%u", (unsigned int)permissions); // Десятичный формат, так как сервер парсит как base 10
 
   char response_buffer[1024];
   memset(response_buffer, 0, sizeof(response_buffer));
   
-  int64_t result = vtfs_http_call(
-      storage->token,
+  int64_t result = net_call(
+      storage,
       "mkdir",
       response_buffer,
       sizeof(response_buffer),
       NULL,
       3,  // 3 args
       "parent", parent_str,
-      "name", encoded_name,
+      "name", wire,
       "mode", mode_str
   );
 
   if (result != 0) {
     printk(KERN_ERR "[vtfs_net] Server mkdir failed with code: %lld\n", (long long)result);
-    if (result > 0) {
-      return (int)result;
-    }
-    return (int)result;
+    return net_errno(result);
   }
 
   int parse_result = parse_node_meta(response_buffer, out);
@@ -373,6 +703,7 @@ static int vtfs_net_storage_create_dir(
     return parse_result;
   }
 
+  attr_cache_set_meta(&storage->attrs, out, attr_ttl(sb));
   return 0;
 }
 
@@ -390,225 +721,414 @@ static int vtfs_net_storage_rmdir(struct super_block* sb, vtfs_ino_t parent, con
 
   char encoded_name[NAME_MAX * 3 + 1];
   char parent_str[32];
-  encode(name, encoded_name);
+  const char* wire = wire_name(storage, name, encoded_name);
   snprintf(parent_str, sizeof(parent_str), "%llu", (unsigned long long)parent);
 
   char response_buffer[1024];
   memset(response_buffer, 0, sizeof(response_buffer));
   
-  int64_t result = vtfs_http_call(
-      storage->token,
+  int64_t result = net_call(
+      storage,
       "rmdir",
       response_buffer,
       sizeof(response_buffer),
       NULL,
       2,  // 2 args
       "parent", parent_str,
-      "name", encoded_name
+      "name", wire
   );
 
   if (result != 0) {
     printk(KERN_ERR "[vtfs_net] Server rmdir failed with code: %lld\n", (long long)result);
-    if (result > 0) {
-      return (int)result;
-    }
-    return (int)result;
+    return net_errno(result);
   }
 
   return 0;
 }
 
-static ssize_t vtfs_net_storage_read(
-    struct super_block* sb, vtfs_ino_t ino, char* buffer, size_t len, loff_t* offset
-) {
-  struct vtfs_net_storage* storage = get_storage(sb);
-  if (!storage) {
-    printk(KERN_ERR "[vtfs_net] Storage not initialized\n");
-    return -EINVAL;
+// One piece of a read or write, run on the async engine so that a large
+// request keeps several round trips in flight
+struct net_io_chunk {
+  struct vtfs_async_req req;
+  struct vtfs_net_storage* storage;
+  vtfs_ino_t ino;
+  loff_t offset;
+  char* data;   // Bounce buffer, unless the chunk works in place
+  struct kvec vec;
+  struct iov_iter iter;  // Where read data lands or written data comes from
+  size_t len;   // Bytes asked for
+  size_t done;  // Bytes the server read or wrote
+};
+
+#define NET_IO_CHUNKS_SIZE (VTFS_ASYNC_MAX_INFLIGHT * sizeof(struct net_io_chunk))
+
+static struct net_io_chunk* alloc_chunks(struct vtfs_net_storage* storage, vtfs_ino_t ino) {
+  struct net_io_chunk* chunks = vtfs_buf_get(&vtfs_small_bufs, NET_IO_CHUNKS_SIZE);
+  if (!chunks)
+    return NULL;
+  memset(chunks, 0, NET_IO_CHUNKS_SIZE);
+  for (int i = 0; i < VTFS_ASYNC_MAX_INFLIGHT; i++) {
+    chunks[i].storage = storage;
+    chunks[i].ino = ino;
   }
+  return chunks;
+}
 
-  if (!buffer || !offset) {
-    printk(KERN_ERR "[vtfs_net] Invalid arguments: buffer or offset is NULL\n");
-    return -EINVAL;
+static void free_chunks(struct net_io_chunk* chunks) {
+  for (int i = 0; i < VTFS_ASYNC_MAX_INFLIGHT; i++)
+    vtfs_buf_put(&vtfs_large_bufs, chunks[i].data, NET_IO_CHUNK);
+  vtfs_buf_put(&vtfs_small_bufs, chunks, NET_IO_CHUNKS_SIZE);
+}
+
+// Set up the next chunk of a window over its bounce buffer. The buffer is
+// taken from the pool on first use and reused by later windows
+static int prepare_chunk(
+    struct net_io_chunk* chunk, unsigned int direction, loff_t offset, size_t len
+) {
+  if (!chunk->data) {
+    chunk->data = vtfs_buf_get(&vtfs_large_bufs, NET_IO_CHUNK);
+    if (!chunk->data)
+      return -ENOMEM;
   }
+  chunk->offset = offset;
+  chunk->len = len;
+  chunk->done = 0;
+  chunk->vec.iov_base = chunk->data;
+  chunk->vec.iov_len = len;
+  iov_iter_kvec(&chunk->iter, direction, &chunk->vec, 1, len);
+  return 0;
+}
 
+// Set up a chunk that works in place, on the next len bytes of *slice
+static void prepare_chunk_in_place(
+    struct net_io_chunk* chunk, loff_t offset, size_t len, struct iov_iter* slice
+) {
+  chunk->offset = offset;
+  chunk->len = len;
+  chunk->done = 0;
+  chunk->iter = *slice;
+  iov_iter_truncate(&chunk->iter, len);
+  iov_iter_advance(slice, len);
+}
+
+// Read len bytes at offset into dest, *done tells how many the server had
+static int64_t read_one(
+    struct vtfs_net_storage* storage,
+    vtfs_ino_t ino,
+    loff_t offset,
+    size_t len,
+    struct iov_iter* dest,
+    size_t* done
+) {
   char ino_str[32];
   char len_str[32];
   char offset_str[32];
   snprintf(ino_str, sizeof(ino_str), "%llu", (unsigned long long)ino);
   snprintf(len_str, sizeof(len_str), "%zu", len);
-  snprintf(offset_str, sizeof(offset_str), "%lld", (long long)*offset);
+  snprintf(offset_str, sizeof(offset_str), "%lld", (long long)offset);
 
-  size_t response_buffer_size = len + 1024;
-  char* response_buffer = kmalloc(response_buffer_size, GFP_KERNEL);
-  if (!response_buffer) {
-    return -ENOMEM;
-  }
-  memset(response_buffer, 0, response_buffer_size);
-  
-  size_t data_length = 0;
-  int64_t result = vtfs_http_call(
-      storage->token,
+  return net_call_iter(
+      storage,
       "read",
-      response_buffer,
-      response_buffer_size,
-      &data_length,
+      dest,
+      done,
       3,  // 3 args
       "ino", ino_str,
       "len", len_str,
       "offset", offset_str
   );
+}
 
-  if (result != 0) {
-    printk(KERN_ERR "[vtfs_net] Server read failed with code: %lld\n", (long long)result);
-    kfree(response_buffer);
-    if (result > 0) {
-      return (int)result;
-    }
-    return (int)result;
-  }
-
-  size_t bytes_to_copy = data_length;
-  if (bytes_to_copy > len) {
-    bytes_to_copy = len;
-  }
-  if (bytes_to_copy > response_buffer_size) {
-    bytes_to_copy = response_buffer_size;
-  }
-
-  if (copy_to_user((char __user*)buffer, response_buffer, bytes_to_copy)) {
-    kfree(response_buffer);
-    return -EFAULT;
-  }
-  
-  *offset += bytes_to_copy;
+static int64_t read_chunk(struct vtfs_async_req* req) {
+  struct net_io_chunk* chunk = container_of(req, struct net_io_chunk, req);
 
-  kfree(response_buffer);
-  return (ssize_t)bytes_to_copy;
+  return read_one(
+      chunk->storage, chunk->ino, chunk->offset, chunk->len, &chunk->iter, &chunk->done
+  );
 }
 
-static ssize_t vtfs_net_storage_write(
-  struct super_block* sb, vtfs_ino_t ino, const char* buffer, size_t len, loff_t* offset
+static ssize_t vtfs_net_storage_read(
+    struct super_block* sb, vtfs_ino_t ino, struct iov_iter* to, loff_t* offset
 ) {
-struct vtfs_net_storage* storage = get_storage(sb);
-if (!storage) {
-  printk(KERN_ERR "[vtfs_net] Storage not initialized\n");
-  return -EINVAL;
-}
-
-if (!buffer || !offset) {
-  printk(KERN_ERR "[vtfs_net] Invalid arguments: buffer or offset is NULL\n");
-  return -EINVAL;
-}
+  struct vtfs_net_storage* storage = get_storage(sb);
+  if (!storage) {
+    printk(KERN_ERR "[vtfs_net] Storage not initialized\n");
+    return -EINVAL;
+  }
 
-const size_t MAX_CHUNK_SIZE = 4 * 1024; // 4KB
+  if (!to || !offset) {
+    printk(KERN_ERR "[vtfs_net] Invalid arguments: iterator or offset is NULL\n");
+    return -EINVAL;
+  }
 
-loff_t current_offset = *offset;
-size_t total_written = 0;
-size_t remaining = len;
-const char* current_ptr = buffer;
+  size_t remaining = iov_iter_count(to);
+  if (remaining == 0)
+    return 0;
 
-while (remaining > 0) {
-  size_t chunk_size = (remaining > MAX_CHUNK_SIZE) ? MAX_CHUNK_SIZE : remaining;
-  
-  char* kernel_buffer = kmalloc(chunk_size, GFP_KERNEL);
-  if (!kernel_buffer) {
-    return total_written > 0 ? (ssize_t)total_written : -ENOMEM;
-  }
-  
-  if (copy_from_user(kernel_buffer, current_ptr, chunk_size)) {
-    kfree(kernel_buffer);
-    return total_written > 0 ? (ssize_t)total_written : -EFAULT;
+  // One round trip is all there is to overlap. Receive it on the caller's
+  // task, straight into any kind of memory
+  if (remaining <= NET_IO_CHUNK) {
+    size_t done = 0;
+    int64_t result = read_one(storage, ino, *offset, remaining, to, &done);
+    if (result != 0) {
+      printk(KERN_ERR "[vtfs_net] Server read failed with code: %lld at offset %lld\n",
+             (long long)result, (long long)*offset);
+      return net_errno(result);
+    }
+    done = min(done, remaining);
+    *offset += done;
+    return (ssize_t)done;
   }
 
-  size_t base64_size = BASE64_SIZE(chunk_size);
-  char* base64_buffer = kmalloc(base64_size, GFP_KERNEL);
-  if (!base64_buffer) {
-    kfree(kernel_buffer);
-    return total_written > 0 ? (ssize_t)total_written : -ENOMEM;
-  }
+  struct net_io_chunk* chunks = alloc_chunks(storage, ino);
+  if (!chunks)
+    return -ENOMEM;
 
-  int base64_len = base64_encode(kernel_buffer, chunk_size, base64_buffer, base64_size);
-  kfree(kernel_buffer);
-  if (base64_len < 0) {
-    printk(KERN_ERR "[vtfs_net] Base64 encoding failed\n");
-    kfree(base64_buffer);
-    return total_written > 0 ? (ssize_t)total_written : -EINVAL;
-  }
+  // Workers can fill page cache folios and kernel buffers in place. User
+  // memory is only reachable from the caller's task, it needs a bounce buffer
+  bool in_place = iov_iter_is_bvec(to) || iov_iter_is_kvec(to);
+  loff_t current_offset = *offset;
+  size_t total_read = 0;
+  int error = 0;
+  bool stop = false;
+
+  while (remaining > 0 && !stop) {
+    int nr = 0;
+    loff_t window_offset = current_offset;
+    struct iov_iter slice = *to;
+
+    while (nr < VTFS_ASYNC_MAX_INFLIGHT && remaining > 0) {
+      struct net_io_chunk* chunk = &chunks[nr];
+      size_t len = min_t(size_t, remaining, NET_IO_CHUNK);
+
+      if (in_place) {
+        prepare_chunk_in_place(chunk, window_offset, len, &slice);
+      } else if (prepare_chunk(chunk, ITER_DEST, window_offset, len)) {
+        // Finish what is already queued, then stop
+        error = -ENOMEM;
+        stop = true;
+        break;
+      }
+      vtfs_async_submit(&storage->async, &chunk->req, read_chunk);
+      window_offset += len;
+      remaining -= len;
+      nr++;
+    }
+
+    // Chunks complete in any order but are consumed in file order.
+    // Everything past an error or a short read (EOF) is dropped
+    bool consumed_all = true;
+    for (int i = 0; i < nr; i++) {
+      struct net_io_chunk* chunk = &chunks[i];
+      int64_t result = vtfs_async_wait(&chunk->req);
+
+      if (!consumed_all)
+        continue;
+
+      if (result != 0) {
+        printk(KERN_ERR "[vtfs_net] Server read #%llu failed with code: %lld at offset %lld\n",
+               chunk->req.id, (long long)result, (long long)chunk->offset);
+        error = net_errno(result);
+        consumed_all = false;
+        continue;
+      }
 
-  // URL encoding
-  char* encoded_data = kmalloc(base64_size * 3, GFP_KERNEL);
-  if (!encoded_data) {
-    kfree(base64_buffer);
-    return total_written > 0 ? (ssize_t)total_written : -ENOMEM;
+      size_t bytes = min(chunk->done, chunk->len);
+      size_t copied = bytes;
+      if (in_place)
+        iov_iter_advance(to, bytes);
+      else
+        copied = copy_to_iter(chunk->data, bytes, to);
+      current_offset += copied;
+      total_read += copied;
+      if (copied < bytes)
+        error = -EFAULT;
+      if (copied < chunk->len)
+        consumed_all = false;
+    }
+    if (!consumed_all)
+      stop = true;
   }
-  encode(base64_buffer, encoded_data);
-  kfree(base64_buffer);
 
+  free_chunks(chunks);
+  if (total_read == 0 && error)
+    return error;
+  *offset = current_offset;
+  return (ssize_t)total_read;
+}
+
+// Write the bytes of data at offset, carried raw as the request payload.
+// data is left as it is, *done tells how many the server stored
+static int64_t write_one(
+    struct vtfs_net_storage* storage,
+    vtfs_ino_t ino,
+    loff_t offset,
+    const struct iov_iter* data,
+    size_t* done
+) {
+  size_t len = iov_iter_count(data);
   char ino_str[32];
   char len_str[32];
   char offset_str[32];
   snprintf(ino_str, sizeof(ino_str), "%llu", (unsigned long long)ino);
-  snprintf(len_str, sizeof(len_str), "%zu", chunk_size);
-  snprintf(offset_str, sizeof(offset_str), "%lld", (long long)current_offset);
+  snprintf(len_str, sizeof(len_str), "%zu", len);
+  snprintf(offset_str, sizeof(offset_str), "%lld", (long long)offset);
 
   char response_buffer[256];
   memset(response_buffer, 0, sizeof(response_buffer));
-  
+
+  // Writes at an explicit offset, a replay stores the same bytes again
   size_t write_data_length = 0;
-  int64_t result = vtfs_http_call(
-      storage->token,
+  int64_t result = net_call_payload(
+      storage,
       "write",
+      true,
+      data,
       response_buffer,
       sizeof(response_buffer),
       &write_data_length,
-      4,  // 4 args
+      3,  // 3 args
       "ino", ino_str,
       "len", len_str,
-      "offset", offset_str,
-      "data", encoded_data
+      "offset", offset_str
   );
+  if (result != 0)
+    return result;
 
-  kfree(encoded_data);
-
-  if (result != 0) {
-    printk(KERN_ERR "[vtfs_net] Server write failed with code: %lld at offset %lld\n", 
-           (long long)result, (long long)current_offset);
-    if (total_written > 0) {
-      *offset = current_offset;
-      return (ssize_t)total_written;
-    }
-    if (result > 0) {
-      return (int)result;
-    }
-    return (int)result;
-  }
-
-  if (sizeof(response_buffer) < sizeof(int64_t)) {
+  if (write_data_length < sizeof(int64_t)) {
     printk(KERN_ERR "[vtfs_net] Response buffer too small\n");
-    if (total_written > 0) {
-      *offset = current_offset;
-      return (ssize_t)total_written;
-    }
     return -EINVAL;
   }
 
   __le64 written_le;
   memcpy(&written_le, response_buffer, sizeof(written_le));
   int64_t written = le64_to_cpu(written_le);
+  if (written < 0 || (size_t)written > len)
+    return -EIO;
 
-  current_offset += written;
-  total_written += written;
-  current_ptr += written;
-  remaining -= written;
+  *done = written;
+  return 0;
+}
 
-  if (written < (ssize_t)chunk_size) {
-    break;
-  }
+static int64_t write_chunk(struct vtfs_async_req* req) {
+  struct net_io_chunk* chunk = container_of(req, struct net_io_chunk, req);
+
+  return write_one(chunk->storage, chunk->ino, chunk->offset, &chunk->iter, &chunk->done);
 }
 
-*offset = current_offset;
-return (ssize_t)total_written;
+static ssize_t vtfs_net_storage_write(
+    struct super_block* sb, vtfs_ino_t ino, struct iov_iter* from, loff_t* offset
+) {
+  struct vtfs_net_storage* storage = get_storage(sb);
+  if (!storage) {
+    printk(KERN_ERR "[vtfs_net] Storage not initialized\n");
+    return -EINVAL;
+  }
+
+  if (!from || !offset) {
+    printk(KERN_ERR "[vtfs_net] Invalid arguments: iterator or offset is NULL\n");
+    return -EINVAL;
+  }
+
+  size_t remaining = iov_iter_count(from);
+  if (remaining == 0)
+    return 0;
+
+  // Single round trip: send from the caller's memory on the caller's task
+  if (remaining <= NET_IO_CHUNK) {
+    size_t done = 0;
+    int64_t result = write_one(storage, ino, *offset, from, &done);
+    if (result != 0) {
+      printk(KERN_ERR "[vtfs_net] Server write failed with code: %lld at offset %lld\n",
+             (long long)result, (long long)*offset);
+      return net_errno(result);
+    }
+    iov_iter_advance(from, done);
+    *offset += done;
+    attr_cache_extend_size(&storage->attrs, ino, *offset);
+    return (ssize_t)done;
+  }
+
+  struct net_io_chunk* chunks = alloc_chunks(storage, ino);
+  if (!chunks)
+    return -ENOMEM;
+
+  // Workers send page cache folios and kernel buffers as they are, user
+  // memory is copied on this task first
+  bool in_place = iov_iter_is_bvec(from) || iov_iter_is_kvec(from);
+  loff_t current_offset = *offset;
+  size_t total_written = 0;
+  int error = 0;
+  bool stop = false;
+
+  while (remaining > 0 && !stop) {
+    int nr = 0;
+    loff_t window_offset = current_offset;
+    struct iov_iter slice = *from;
+
+    while (nr < VTFS_ASYNC_MAX_INFLIGHT && remaining > 0) {
+      struct net_io_chunk* chunk = &chunks[nr];
+      size_t len = min_t(size_t, remaining, NET_IO_CHUNK);
+
+      if (in_place) {
+        prepare_chunk_in_place(chunk, window_offset, len, &slice);
+      } else if (prepare_chunk(chunk, ITER_SOURCE, window_offset, len)) {
+        error = -ENOMEM;
+        stop = true;
+        break;
+      } else if (copy_from_iter(chunk->data, len, &slice) != len) {
+        error = -EFAULT;
+        stop = true;
+        break;
+      }
+      vtfs_async_submit(&storage->async, &chunk->req, write_chunk);
+      window_offset += len;
+      remaining -= len;
+      nr++;
+    }
+
+    // Only a prefix of fully written chunks counts. A chunk stored past a
+    // failed or short one leaves a gap of old data in the file, which no
+    // byte count can describe
+    bool written_all = true;
+    size_t window_written = 0;
+    for (int i = 0; i < nr; i++) {
+      struct net_io_chunk* chunk = &chunks[i];
+      int64_t result = vtfs_async_wait(&chunk->req);
+
+      if (!written_all) {
+        if (result == 0 && chunk->done)
+          error = -EIO;
+        continue;
+      }
+
+      if (result != 0) {
+        printk(KERN_ERR "[vtfs_net] Server write #%llu failed with code: %lld at offset %lld\n",
+               chunk->req.id, (long long)result, (long long)chunk->offset);
+        error = net_errno(result);
+        written_all = false;
+        continue;
+      }
+
+      window_written += chunk->done;
+      if (chunk->done < chunk->len)
+        written_all = false;
+    }
+
+    // The unwritten tail stays with the caller
+    iov_iter_advance(from, window_written);
+    current_offset += window_written;
+    total_written += window_written;
+    if (!written_all)
+      stop = true;
+  }
+
+  free_chunks(chunks);
+  if ((total_written == 0 && error) || error == -EIO)
+    return error;
+  attr_cache_extend_size(&storage->attrs, ino, current_offset);
+  *offset = current_offset;
+  return (ssize_t)total_written;
 }
 
 static int vtfs_net_storage_link(
@@ -629,15 +1149,15 @@ static int vtfs_net_storage_link(
   char encoded_name[NAME_MAX * 3 + 1];
   char target_ino_str[32];
   char parent_str[32];
-  encode(name, encoded_name);
+  const char* wire = wire_name(storage, name, encoded_name);
   snprintf(target_ino_str, sizeof(target_ino_str), "%llu", (unsigned long long)target_ino);
   snprintf(parent_str, sizeof(parent_str), "%llu", (unsigned long long)parent);
 
   char response_buffer[1024];
   memset(response_buffer, 0, sizeof(response_buffer));
   
-  int64_t result = vtfs_http_call(
-      storage->token,
+  int64_t result = net_call(
+      storage,
       "link",
       response_buffer,
       sizeof(response_buffer),
@@ -645,17 +1165,15 @@ static int vtfs_net_storage_link(
       3,  // 3 args
       "target_ino", target_ino_str,
       "parent", parent_str,
-      "name", encoded_name
+      "name", wire
   );
 
   if (result != 0) {
     printk(KERN_ERR "[vtfs_net] Server link failed with code: %lld\n", (long long)result);
-    if (result > 0) {
-      return (int)result;
-    }
-    return (int)result;
+    return net_errno(result);
   }
 
+  attr_cache_forget(&storage->attrs, target_ino);  // Link count changed
   return 0;
 }
 
@@ -666,6 +1184,10 @@ static unsigned int vtfs_net_storage_count_links(struct super_block* sb, vtfs_in
     return 0;
   }
 
+  unsigned int count;
+  if (attr_cache_get_nlink(&storage->attrs, ino, &count))
+    return count;
+
   char ino_str[32];
   snprintf(ino_str, sizeof(ino_str), "%llu", (unsigned long long)ino);
 
@@ -673,8 +1195,8 @@ static unsigned int vtfs_net_storage_count_links(struct super_block* sb, vtfs_in
   memset(response_buffer, 0, sizeof(response_buffer));
   
   size_t data_length = 0;
-  int64_t result = vtfs_http_call(
-      storage->token,
+  int64_t result = net_call(
+      storage,
       "count_links",
       response_buffer,
       sizeof(response_buffer),
@@ -696,18 +1218,75 @@ static unsigned int vtfs_net_storage_count_links(struct super_block* sb, vtfs_in
 
   __le32 count_le;
   memcpy(&count_le, response_buffer, sizeof(count_le));
-  unsigned int count = le32_to_cpu(count_le);
+  count = le32_to_cpu(count_le);
 
+  attr_cache_set_nlink(&storage->attrs, ino, count, attr_ttl(sb));
   return count;
 }
 
+static int vtfs_net_storage_getattr(
+    struct super_block* sb,
+    vtfs_ino_t parent,
+    const char* name,
+    vtfs_ino_t ino,
+    struct vtfs_node_meta* out,
+    unsigned int* nlink,
+    bool* fetched
+) {
+  struct vtfs_net_storage* storage = get_storage(sb);
+  if (!storage) {
+    printk(KERN_ERR "[vtfs_net] Storage not initialized\n");
+    return -EINVAL;
+  }
+
+  // The server has no stat by ino, an expired lease is renewed by name
+  *fetched = false;
+  if (attr_cache_get_meta(&storage->attrs, ino, out)) {
+    out->nlink = 0;  // Leased separately, ask count_links
+  } else {
+    *fetched = true;
+    int ret = vtfs_net_storage_lookup(sb, parent, name, out);
+    if (ret)
+      return ret;
+    if (out->ino != ino)
+      return -ESTALE;
+  }
+
+  if (out->type == VTFS_NODE_DIR) {
+    *nlink = 2;
+  } else if (out->nlink) {
+    *nlink = out->nlink;
+  } else {
+    *nlink = vtfs_net_storage_count_links(sb, ino);
+  }
+  return 0;
+}
+
+static int vtfs_net_storage_global_init(void) {
+  return vtfs_buf_pools_init();
+}
+
+static void vtfs_net_storage_global_exit(void) {
+  vtfs_buf_pools_exit();
+}
+
+static void vtfs_net_storage_forget(struct super_block* sb, vtfs_ino_t ino) {
+  struct vtfs_net_storage* storage = get_storage(sb);
+  if (storage)
+    attr_cache_forget(&storage->attrs, ino);
+}
+
 // Ops struct
 static const struct vtfs_storage_ops net_storage_ops = {
+    .flags = VTFS_STORAGE_PAGE_CACHE | VTFS_STORAGE_REMOTE,
+    .global_init = vtfs_net_storage_global_init,
+    .global_exit = vtfs_net_storage_global_exit,
     .init = vtfs_net_storage_init,
     .shutdown = vtfs_net_storage_shutdown,
     .get_root = vtfs_net_storage_get_root,
     .lookup = vtfs_net_storage_lookup,
     .iterate_dir = vtfs_net_storage_iterate_dir,
+    .iterate_dir_plus = vtfs_net_storage_iterate_dir_plus,
     .create_file = vtfs_net_storage_create_file,
     .unlink = vtfs_net_storage_unlink,
     .mkdir = vtfs_net_storage_create_dir,
@@ -716,6 +1295,8 @@ static const struct vtfs_storage_ops net_storage_ops = {
     .write = vtfs_net_storage_write,
     .link = vtfs_net_storage_link,
     ._count_links = vtfs_net_storage_count_links,
+    .getattr = vtfs_net_storage_getattr,
+    .forget = vtfs_net_storage_forget,
 };
 
 const struct vtfs_storage_ops* vtfs_get_net_storage_ops(void) {
@@ -0,0 +1,79 @@
+#include "range_lock.h"
+
+#include <linux/sched.h>
+
+void vtfs_range_lock_tree_init(struct vtfs_range_lock_tree* tree) {
+  spin_lock_init(&tree->lock);
+  INIT_LIST_HEAD(&tree->held);
+  INIT_LIST_HEAD(&tree->waiting);
+  init_waitqueue_head(&tree->wait);
+}
+
+static bool ranges_conflict(const struct vtfs_range_lock* a, const struct vtfs_range_lock* b) {
+  if (!a->exclusive && !b->exclusive)
+    return false;
+  return a->start < b->end && b->start < a->end;
+}
+
+// Grab the range if nothing incompatible is held or queued ahead of it.
+// Waiters are served in arrival order wherever they overlap, so a stream
+// of readers cannot starve a writer
+static bool range_trylock(struct vtfs_range_lock_tree* tree, struct vtfs_range_lock* range) {
+  struct vtfs_range_lock* cur;
+  bool locked = true;
+
+  spin_lock(&tree->lock);
+  list_for_each_entry(cur, &tree->held, list) {
+    if (ranges_conflict(cur, range)) {
+      locked = false;
+      goto out;
+    }
+  }
+  list_for_each_entry(cur, &tree->waiting, list) {
+    if (cur == range)
+      break;
+    if (ranges_conflict(cur, range)) {
+      locked = false;
+      goto out;
+    }
+  }
+  list_move_tail(&range->list, &tree->held);
+out:
+  spin_unlock(&tree->lock);
+
+  return locked;
+}
+
+int vtfs_range_lock(
+    struct vtfs_range_lock_tree* tree,
+    struct vtfs_range_lock* range,
+    loff_t start,
+    loff_t end,
+    bool exclusive
+) {
+  range->start = start;
+  range->end = end;
+  range->exclusive = exclusive;
+
+  spin_lock(&tree->lock);
+  list_add_tail(&range->list, &tree->waiting);
+  spin_unlock(&tree->lock);
+
+  int ret = wait_event_killable(tree->wait, range_trylock(tree, range));
+  if (ret) {
+    spin_lock(&tree->lock);
+    list_del(&range->list);
+    spin_unlock(&tree->lock);
+    // Whoever queued behind us may go now
+    wake_up_all(&tree->wait);
+  }
+  return ret;
+}
+
+void vtfs_range_unlock(struct vtfs_range_lock_tree* tree, struct vtfs_range_lock* range) {
+  spin_lock(&tree->lock);
+  list_del(&range->list);
+  spin_unlock(&tree->lock);
+
+  wake_up_all(&tree->wait);
+}
@@ -0,0 +1,40 @@
+#ifndef VTFS_RANGE_LOCK_H
+#define VTFS_RANGE_LOCK_H
+
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/wait.h>
+
+// Byte-range reader/writer lock. Shared holders of overlapping ranges and
+// holders of disjoint ranges proceed in parallel, an exclusive holder
+// excludes every overlapping range. Overlapping requests that conflict are
+// granted in arrival order
+struct vtfs_range_lock_tree {
+  spinlock_t lock;
+  struct list_head held;
+  struct list_head waiting;  // Oldest first
+  wait_queue_head_t wait;
+};
+
+struct vtfs_range_lock {
+  struct list_head list;
+  loff_t start;
+  loff_t end;  // Exclusive
+  bool exclusive;
+};
+
+void vtfs_range_lock_tree_init(struct vtfs_range_lock_tree* tree);
+
+// Lock [start, end), sleeping while an incompatible range is held or
+// queued first. Returns -ERESTARTSYS if a fatal signal came first
+int vtfs_range_lock(
+    struct vtfs_range_lock_tree* tree,
+    struct vtfs_range_lock* range,
+    loff_t start,
+    loff_t end,
+    bool exclusive
+);
+void vtfs_range_unlock(struct vtfs_range_lock_tree* tree, struct vtfs_range_lock* range);
+
+#endif  // VTFS_RANGE_LOCK_H
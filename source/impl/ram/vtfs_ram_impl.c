@@ -1,128 +1,411 @@
+#include <linux/atomic.h>
 #include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/jhash.h>
+#include <linux/mutex.h>
+#include <linux/pagemap.h>
+#include <linux/rcupdate.h>
+#include <linux/refcount.h>
+#include <linux/rhashtable.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/string.h>
 #include <linux/uaccess.h>
+#include <linux/uio.h>
+#include <linux/xarray.h>
 
 #include "../../vtfs.h"
 #include "../../vtfs_interface.h"
+#include "range_lock.h"
+
+// Locking:
+//  - name lookups and readdir run under RCU; nodes and payloads are freed
+//    after a grace period
+//  - namespace changes of a directory are serialized by its dir_lock
+//  - file data is protected by byte-range locks on the payload: readers
+//    share a range, writers own it, disjoint ranges don't wait on each
+//    other. Page slots are installed atomically, so writers of
+//    neighbouring ranges within one page don't need the same lock
+//  - size only grows, under size_lock; readers snapshot it locklessly
+//  - small files keep their data inline in the payload. Moving it to pages
+//    takes the whole file range exclusively, so the flag is stable for
+//    anyone holding a range
+//  - payload lifetime is refcounted: links collectively hold one reference,
+//    every operation in flight holds another
+
+// Files up to this size don't take a page of their own
+#define VTFS_RAM_INLINE_DATA 96
 
 struct vtfs_ram_inode_payload {
   struct vtfs_node_meta meta;
-  char* data;
-  size_t capacity;
-  unsigned int ref_count;
+  atomic_t nlink;
+  refcount_t ref;
+  struct rcu_head rcu;
+
+  union {
+    // Regular files
+    struct {
+      struct xarray pages;  // Page index -> struct page, holes are absent
+      struct vtfs_range_lock_tree data_ranges;
+      spinlock_t size_lock;
+      bool inlined;  // Data lives in inline_data, pages is empty
+      char inline_data[VTFS_RAM_INLINE_DATA];
+    };
+    // Directories: entries keyed by readdir cookie. Their payloads come
+    // from a cache of their own, cut off after this variant
+    struct {
+      struct mutex dir_lock;
+      struct xarray children;
+      u32 next_cookie;
+      bool dead;  // Removed by rmdir, no new entries allowed
+    };
+  };
 };
 
+#define VTFS_RAM_DIR_PAYLOAD_SIZE offsetofend(struct vtfs_ram_inode_payload, dead)
+
+// Most names are short: keep them in the node, like dentries do
+#define VTFS_RAM_INLINE_NAME 32
+
 struct vtfs_ram_node {
-  char name[NAME_MAX + 1];
-  struct vtfs_ram_node* next;
+  struct rhash_head hash;
   vtfs_ino_t parent_ino;
+  u32 cookie;  // Position in the parent's children, stable for the node lifetime
+  const char* name;  // inline_name or an exact-size allocation
   struct vtfs_ram_inode_payload* payload;
+  struct rcu_head rcu;
+  char inline_name[VTFS_RAM_INLINE_NAME];
 };
 
 struct vtfs_ram_storage {
-  struct vtfs_ram_node* nodes_head;
-  vtfs_ino_t next_ino;
+  struct rhashtable names;  // (parent_ino, name) -> node
+  struct xarray inodes;     // ino -> payload
+  atomic_long_t next_ino;
+
+  // Live inodes and the bytes of payloads, nodes and names they take
+  atomic_long_t nr_inodes;
+  atomic_long_t meta_bytes;
 };
 
-static struct vtfs_ram_storage* get_storage(struct super_block* sb) {
-  return (struct vtfs_ram_storage*)sb->s_fs_info;
+static struct kmem_cache* vtfs_ram_file_cachep;
+static struct kmem_cache* vtfs_ram_dir_cachep;
+static struct kmem_cache* vtfs_ram_node_cachep;
+
+static struct kmem_cache* payload_cache(enum vtfs_node_type type) {
+  return type == VTFS_NODE_DIR ? vtfs_ram_dir_cachep : vtfs_ram_file_cachep;
 }
 
-static struct vtfs_ram_node* find_node_by_ino(struct vtfs_ram_storage* storage, vtfs_ino_t ino) {
-  struct vtfs_ram_node* cur = storage->nodes_head;
+// Lookup key of the name index
+struct vtfs_ram_name_key {
+  vtfs_ino_t parent_ino;
+  const char* name;
+};
 
-  while (cur) {
-    if (cur->payload && cur->payload->meta.ino == ino)
-      return cur;
-    cur = cur->next;
-  }
+static u32 name_hash(vtfs_ino_t parent_ino, const char* name, u32 seed) {
+  u64 parent = parent_ino;
+  return jhash(name, strlen(name), jhash_2words((u32)parent, (u32)(parent >> 32), seed));
+}
 
-  return NULL;
+static u32 name_key_hashfn(const void* data, u32 len, u32 seed) {
+  const struct vtfs_ram_name_key* key = data;
+  return name_hash(key->parent_ino, key->name, seed);
 }
 
-static struct vtfs_ram_inode_payload* find_payload_by_ino(
+static u32 name_obj_hashfn(const void* data, u32 len, u32 seed) {
+  const struct vtfs_ram_node* node = data;
+  return name_hash(node->parent_ino, node->name, seed);
+}
+
+static int name_obj_cmpfn(struct rhashtable_compare_arg* arg, const void* obj) {
+  const struct vtfs_ram_name_key* key = arg->key;
+  const struct vtfs_ram_node* node = obj;
+
+  if (node->parent_ino != key->parent_ino)
+    return 1;
+  return strcmp(node->name, key->name);
+}
+
+static const struct rhashtable_params name_index_params = {
+    .head_offset = offsetof(struct vtfs_ram_node, hash),
+    .hashfn = name_key_hashfn,
+    .obj_hashfn = name_obj_hashfn,
+    .obj_cmpfn = name_obj_cmpfn,
+    .automatic_shrinking = true,
+};
+
+static struct vtfs_ram_storage* get_storage(struct super_block* sb) {
+  return (struct vtfs_ram_storage*)VTFS_SB(sb)->storage;
+}
+
+// Take a temporary reference on the payload of ino, NULL if there is none
+static struct vtfs_ram_inode_payload* get_payload(
     struct vtfs_ram_storage* storage, vtfs_ino_t ino
 ) {
-  struct vtfs_ram_node* node = find_node_by_ino(storage, ino);
-  if (node && node->payload)
-    return node->payload;
-  return NULL;
+  rcu_read_lock();
+  struct vtfs_ram_inode_payload* payload = xa_load(&storage->inodes, ino);
+  if (payload && !refcount_inc_not_zero(&payload->ref))
+    payload = NULL;
+  rcu_read_unlock();
+  return payload;
 }
 
+// Caller holds the parent's dir_lock or is inside an RCU read section
 static struct vtfs_ram_node* find_child(
     struct vtfs_ram_storage* storage, vtfs_ino_t parent, const char* name
 ) {
-  struct vtfs_ram_node* cur = storage->nodes_head;
+  struct vtfs_ram_name_key key = {.parent_ino = parent, .name = name};
+  return rhashtable_lookup_fast(&storage->names, &key, name_index_params);
+}
+
+// Snapshot metadata, size may change under a concurrent writer
+static void read_meta(struct vtfs_ram_inode_payload* payload, struct vtfs_node_meta* out) {
+  *out = payload->meta;
+  out->size = READ_ONCE(payload->meta.size);
+  out->nlink = atomic_read(&payload->nlink);
+}
+
+// Allocate a payload for a new inode and publish it in the ino index
+static struct vtfs_ram_inode_payload* alloc_payload(
+    struct vtfs_ram_storage* storage,
+    vtfs_ino_t ino,
+    vtfs_ino_t parent,
+    enum vtfs_node_type type,
+    umode_t mode
+) {
+  struct vtfs_ram_inode_payload* payload = kmem_cache_zalloc(payload_cache(type), GFP_KERNEL);
+  if (!payload)
+    return ERR_PTR(-ENOMEM);
+
+  atomic_set(&payload->nlink, 1);
+  refcount_set(&payload->ref, 1);
+  payload->meta.ino = ino;
+  payload->meta.parent_ino = parent;
+  payload->meta.type = type;
+  payload->meta.mode = mode;
+  payload->meta.size = 0;
+  if (type == VTFS_NODE_DIR) {
+    mutex_init(&payload->dir_lock);
+    xa_init_flags(&payload->children, XA_FLAGS_ALLOC);
+    payload->next_cookie = 0;
+    payload->dead = false;
+  } else {
+    xa_init(&payload->pages);
+    vtfs_range_lock_tree_init(&payload->data_ranges);
+    spin_lock_init(&payload->size_lock);
+    payload->inlined = true;
+  }
 
-  while (cur) {
-    if (cur->parent_ino == parent && !strcmp(cur->name, name))
-      return cur;
-    cur = cur->next;
+  int ret = xa_insert(&storage->inodes, ino, payload, GFP_KERNEL);
+  if (ret) {
+    kmem_cache_free(payload_cache(type), payload);
+    return ERR_PTR(ret);
   }
 
-  return NULL;
+  atomic_long_inc(&storage->nr_inodes);
+  atomic_long_add(kmem_cache_size(payload_cache(type)), &storage->meta_bytes);
+  return payload;
 }
 
-static unsigned int count_links_to_ino(struct vtfs_ram_storage* storage, vtfs_ino_t ino) {
-  struct vtfs_ram_inode_payload* payload = find_payload_by_ino(storage, ino);
-  if (payload)
-    return payload->ref_count;
-  return 0;
+// Release everything the payload owns but the structure itself
+static void free_payload_data(struct vtfs_ram_inode_payload* payload) {
+  struct page* page;
+  unsigned long index;
+
+  if (payload->meta.type == VTFS_NODE_DIR) {
+    xa_destroy(&payload->children);
+    return;
+  }
+
+  xa_for_each(&payload->pages, index, page) {
+    __free_page(page);
+  }
+  xa_destroy(&payload->pages);
 }
 
-static struct vtfs_ram_inode_payload* alloc_payload(void) {
-  struct vtfs_ram_inode_payload* payload = kzalloc(sizeof(*payload), GFP_KERNEL);
-  if (payload) {
-    payload->ref_count = 1;
-    payload->data = NULL;
-    payload->capacity = 0;
+// Find the page backing index, allocating a zeroed one in place of a hole
+static struct page* get_page_for_write(struct vtfs_ram_inode_payload* payload, pgoff_t index) {
+  struct page* page = xa_load(&payload->pages, index);
+  if (page)
+    return page;
+
+  page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+  if (!page)
+    return ERR_PTR(-ENOMEM);
+
+  // A writer of another range of the same page may have beaten us to it
+  struct page* old = xa_cmpxchg(&payload->pages, index, NULL, page, GFP_KERNEL);
+  if (old) {
+    __free_page(page);
+    return xa_is_err(old) ? ERR_PTR(xa_err(old)) : old;
   }
-  return payload;
+  return page;
+}
+
+// Move inline data to page 0. Caller holds the whole file range exclusively
+static int promote_inline(struct vtfs_ram_inode_payload* payload) {
+  if (payload->meta.size) {
+    struct page* page = get_page_for_write(payload, 0);
+    if (IS_ERR(page))
+      return PTR_ERR(page);
+    memcpy_to_page(page, 0, payload->inline_data, VTFS_RAM_INLINE_DATA);
+  }
+
+  // Lockless SEEK_DATA/SEEK_HOLE must find the page once the flag is clear
+  smp_store_release(&payload->inlined, false);
+  return 0;
 }
 
-// Increment reference count for payload
-static void payload_get(struct vtfs_ram_inode_payload* payload) {
-  if (payload)
-    payload->ref_count++;
+// Grow the file to new_size, never shrink it: writers of disjoint ranges
+// finish in any order
+static void extend_size(struct vtfs_ram_inode_payload* payload, loff_t new_size) {
+  spin_lock(&payload->size_lock);
+  if (new_size > payload->meta.size)
+    WRITE_ONCE(payload->meta.size, new_size);
+  spin_unlock(&payload->size_lock);
 }
 
-// Decrement reference count and free if zero
-static void payload_put(struct vtfs_ram_inode_payload* payload) {
-  if (!payload)
-    return;
+static void free_payload_rcu(struct rcu_head* head) {
+  struct vtfs_ram_inode_payload* payload =
+      container_of(head, struct vtfs_ram_inode_payload, rcu);
+  kmem_cache_free(payload_cache(payload->meta.type), payload);
+}
 
-  payload->ref_count--;
-  if (payload->ref_count == 0) {
-    if (payload->data) {
-      kfree(payload->data);
-    }
-    kfree(payload);
+// Drop a reference taken with get_payload or owned by the links
+static void put_payload(struct vtfs_ram_inode_payload* payload) {
+  if (refcount_dec_and_test(&payload->ref)) {
+    free_payload_data(payload);
+    call_rcu(&payload->rcu, free_payload_rcu);  // Lockless readers may still look at meta
   }
 }
 
-static struct vtfs_ram_node* alloc_node(struct vtfs_ram_storage* storage) {
-  struct vtfs_ram_node* node = kmalloc(sizeof(*node), GFP_KERNEL);
+// Drop one link; the last one unpublishes the inode
+static void drop_link(struct vtfs_ram_storage* storage, struct vtfs_ram_inode_payload* payload) {
+  if (atomic_dec_and_test(&payload->nlink)) {
+    xa_erase(&storage->inodes, payload->meta.ino);
+    atomic_long_dec(&storage->nr_inodes);
+    atomic_long_sub(kmem_cache_size(payload_cache(payload->meta.type)), &storage->meta_bytes);
+    put_payload(payload);
+  }
+}
+
+static long node_bytes(const struct vtfs_ram_node* node) {
+  long bytes = kmem_cache_size(vtfs_ram_node_cachep);
+  if (node->name != node->inline_name)
+    bytes += strlen(node->name) + 1;
+  return bytes;
+}
+
+static struct vtfs_ram_node* alloc_node(
+    struct vtfs_ram_storage* storage, vtfs_ino_t parent, const char* name
+) {
+  struct vtfs_ram_node* node = kmem_cache_alloc(vtfs_ram_node_cachep, GFP_KERNEL);
   if (!node)
     return NULL;
 
-  node->next = storage->nodes_head;
-  storage->nodes_head = node;
+  size_t len = strnlen(name, NAME_MAX);
+  if (len < VTFS_RAM_INLINE_NAME) {
+    memcpy(node->inline_name, name, len);
+    node->inline_name[len] = '\0';
+    node->name = node->inline_name;
+  } else {
+    node->name = kmemdup_nul(name, len, GFP_KERNEL);
+    if (!node->name) {
+      kmem_cache_free(vtfs_ram_node_cachep, node);
+      return NULL;
+    }
+  }
+
+  node->parent_ino = parent;
+  node->payload = NULL;
+  atomic_long_add(node_bytes(node), &storage->meta_bytes);
   return node;
 }
 
+static void __free_node(struct vtfs_ram_node* node) {
+  if (node->name != node->inline_name)
+    kfree(node->name);
+  kmem_cache_free(vtfs_ram_node_cachep, node);
+}
+
+static void free_node_rcu(struct rcu_head* head) {
+  __free_node(container_of(head, struct vtfs_ram_node, rcu));
+}
+
+// A published node may still be seen by lockless readers, it goes after a grace period
+static void free_node(
+    struct vtfs_ram_storage* storage, struct vtfs_ram_node* node, bool published
+) {
+  if (!node)
+    return;
+
+  atomic_long_sub(node_bytes(node), &storage->meta_bytes);
+  if (published)
+    call_rcu(&node->rcu, free_node_rcu);
+  else
+    __free_node(node);
+}
+
+// Publish node in the name index and in the parent's entries.
+// Fails with -EEXIST if parent already has a child with the same name
+static int insert_node(
+    struct vtfs_ram_storage* storage,
+    struct vtfs_ram_inode_payload* parent,
+    struct vtfs_ram_node* node
+) {
+  lockdep_assert_held(&parent->dir_lock);
+
+  struct vtfs_ram_name_key key = {.parent_ino = node->parent_ino, .name = node->name};
+  int ret = rhashtable_lookup_insert_key(&storage->names, &key, &node->hash, name_index_params);
+  if (ret)
+    return ret;
+
+  // Cookies grow monotonically, so entries added during a listing land after it
+  ret = xa_alloc_cyclic(
+      &parent->children, &node->cookie, node, xa_limit_31b, &parent->next_cookie, GFP_KERNEL
+  );
+  if (ret < 0) {
+    rhashtable_remove_fast(&storage->names, &node->hash, name_index_params);
+    return ret;
+  }
+  return 0;
+}
+
+static void remove_node(
+    struct vtfs_ram_storage* storage,
+    struct vtfs_ram_inode_payload* parent,
+    struct vtfs_ram_node* node
+) {
+  lockdep_assert_held(&parent->dir_lock);
+
+  rhashtable_remove_fast(&storage->names, &node->hash, name_index_params);
+  xa_erase(&parent->children, node->cookie);
+}
+
 static void free_all_nodes(struct vtfs_ram_storage* storage) {
-  struct vtfs_ram_node* cur = storage->nodes_head;
-  while (cur) {
-    struct vtfs_ram_node* next = cur->next;
-    if (cur->payload) {
-      payload_put(cur->payload);
+  struct vtfs_ram_inode_payload* payload;
+  unsigned long ino;
+
+  // Directories own their entries: drop all of them before the inodes
+  xa_for_each(&storage->inodes, ino, payload) {
+    struct vtfs_ram_node* node;
+    unsigned long cookie;
+
+    if (payload->meta.type != VTFS_NODE_DIR)
+      continue;
+    xa_for_each(&payload->children, cookie, node) {
+      __free_node(node);
     }
-    kfree(cur);
-    cur = next;
   }
-  storage->nodes_head = NULL;
-  storage->next_ino = VTFS_ROOT_INO + 1;
+
+  xa_for_each(&storage->inodes, ino, payload) {
+    xa_erase(&storage->inodes, ino);
+    free_payload_data(payload);
+    kmem_cache_free(payload_cache(payload->meta.type), payload);
+  }
+  atomic_long_set(&storage->next_ino, VTFS_ROOT_INO);
+  atomic_long_set(&storage->nr_inodes, 0);
+  atomic_long_set(&storage->meta_bytes, 0);
 }
 
 int vtfs_ram_storage_init(struct super_block* sb, const char* token) {
@@ -130,33 +413,27 @@ int vtfs_ram_storage_init(struct super_block* sb, const char* token) {
   if (!storage)
     return -ENOMEM;
 
-  storage->nodes_head = NULL;
-  storage->next_ino = VTFS_ROOT_INO + 1;
+  xa_init(&storage->inodes);
+  atomic_long_set(&storage->next_ino, VTFS_ROOT_INO);
+  atomic_long_set(&storage->nr_inodes, 0);
+  atomic_long_set(&storage->meta_bytes, 0);
 
-  struct vtfs_ram_node* root = alloc_node(storage);
-  if (!root) {
+  int ret = rhashtable_init(&storage->names, &name_index_params);
+  if (ret) {
     kfree(storage);
-    return -ENOMEM;
+    return ret;
   }
 
-  struct vtfs_ram_inode_payload* root_payload = alloc_payload();
-  if (!root_payload) {
-    kfree(root);
+  // Root has no entry in any directory, only the inode itself
+  struct vtfs_ram_inode_payload* root =
+      alloc_payload(storage, VTFS_ROOT_INO, 0, VTFS_NODE_DIR, S_IFDIR | 0777);
+  if (IS_ERR(root)) {
+    rhashtable_destroy(&storage->names);
     kfree(storage);
-    return -ENOMEM;
+    return PTR_ERR(root);
   }
 
-  root_payload->meta.ino = VTFS_ROOT_INO;
-  root_payload->meta.parent_ino = 0;
-  root_payload->meta.type = VTFS_NODE_DIR;
-  root_payload->meta.mode = S_IFDIR | 0777;
-  root_payload->meta.size = 0;
-
-  root->parent_ino = 0;
-  root->name[0] = '\0';
-  root->payload = root_payload;
-
-  sb->s_fs_info = storage;
+  VTFS_SB(sb)->storage = storage;
   return 0;
 }
 
@@ -166,8 +443,10 @@ void vtfs_ram_storage_shutdown(struct super_block* sb) {
     return;
 
   free_all_nodes(storage);
+  rhashtable_destroy(&storage->names);
+  xa_destroy(&storage->inodes);
   kfree(storage);
-  sb->s_fs_info = NULL;
+  VTFS_SB(sb)->storage = NULL;
 }
 
 int vtfs_ram_storage_get_root(struct super_block* sb, struct vtfs_node_meta* out) {
@@ -175,11 +454,12 @@ int vtfs_ram_storage_get_root(struct super_block* sb, struct vtfs_node_meta* out
   if (!storage)
     return -EINVAL;
 
-  struct vtfs_ram_node* root = find_node_by_ino(storage, VTFS_ROOT_INO);
-  if (!root || !root->payload)
+  struct vtfs_ram_inode_payload* root = get_payload(storage, VTFS_ROOT_INO);
+  if (!root)
     return -ENOENT;
 
-  *out = root->payload->meta;
+  read_meta(root, out);
+  put_payload(root);
   return 0;
 }
 
@@ -190,12 +470,14 @@ int vtfs_ram_storage_lookup(
   if (!storage)
     return -EINVAL;
 
+  // Lockless: nodes and payloads outlive the read section
+  rcu_read_lock();
   struct vtfs_ram_node* node = find_child(storage, parent, name);
-  if (!node || !node->payload)
-    return -ENOENT;
+  if (node)
+    read_meta(node->payload, out);
+  rcu_read_unlock();
 
-  *out = node->payload->meta;
-  return 0;
+  return node ? 0 : -ENOENT;
 }
 
 int vtfs_ram_storage_iterate_dir(
@@ -205,69 +487,100 @@ int vtfs_ram_storage_iterate_dir(
   if (!storage)
     return -EINVAL;
 
-  unsigned long count = 0;
-  struct vtfs_ram_node* cur = storage->nodes_head;
-
-  while (cur) {
-    if (cur->parent_ino == dir_ino && cur->payload) {
-      if (count == *offset) {
-        strncpy(out->name, cur->name, NAME_MAX);
-        out->name[NAME_MAX] = '\0';
-        out->ino = cur->payload->meta.ino;
-        out->type = cur->payload->meta.type;
-
-        (*offset)++;
-        return 0;
-      }
-      count++;
-    }
-    cur = cur->next;
+  int ret = -ENOENT;
+
+  rcu_read_lock();
+  struct vtfs_ram_inode_payload* dir = xa_load(&storage->inodes, dir_ino);
+  if (!dir || dir->meta.type != VTFS_NODE_DIR) {
+    ret = -ENOTDIR;
+    goto out;
   }
 
-  return -ENOENT;
+  // Resume from the first entry whose cookie is not below offset
+  unsigned long cookie = *offset;
+  struct vtfs_ram_node* node = xa_find(&dir->children, &cookie, U32_MAX, XA_PRESENT);
+  if (!node)
+    goto out;
+
+  strscpy(out->name, node->name, sizeof(out->name));
+  out->ino = node->payload->meta.ino;
+  out->type = node->payload->meta.type;
+
+  *offset = cookie + 1;
+  ret = 0;
+out:
+  rcu_read_unlock();
+  return ret;
 }
 
-int vtfs_ram_storage_create_file(
-    struct super_block* sb,
+static int create_node(
+    struct vtfs_ram_storage* storage,
     vtfs_ino_t parent,
     const char* name,
+    enum vtfs_node_type type,
     umode_t mode,
     struct vtfs_node_meta* out
 ) {
-  struct vtfs_ram_storage* storage = get_storage(sb);
-  if (!storage)
-    return -EINVAL;
+  struct vtfs_ram_inode_payload* parent_payload = get_payload(storage, parent);
+  if (!parent_payload)
+    return -ENOENT;
 
-  if (find_child(storage, parent, name))
-    return -EEXIST;
+  int ret = -ENOTDIR;
+  if (parent_payload->meta.type != VTFS_NODE_DIR)
+    goto out_put;
 
-  struct vtfs_ram_node* parent_node = find_node_by_ino(storage, parent);
-  if (!parent_node || !parent_node->payload || parent_node->payload->meta.type != VTFS_NODE_DIR)
-    return -ENOTDIR;
+  struct vtfs_ram_node* node = alloc_node(storage, parent, name);
+  ret = -ENOMEM;
+  if (!node)
+    goto out_put;
 
-  struct vtfs_ram_inode_payload* payload = alloc_payload();
-  if (!payload)
-    return -ENOMEM;
+  mutex_lock(&parent_payload->dir_lock);
 
-  struct vtfs_ram_node* node = alloc_node(storage);
-  if (!node) {
-    payload_put(payload);
-    return -ENOMEM;
-  }
+  ret = -ENOENT;
+  if (parent_payload->dead)
+    goto out_unlock;
 
-  payload->meta.ino = storage->next_ino++;
-  payload->meta.parent_ino = parent;
-  payload->meta.type = VTFS_NODE_FILE;
-  payload->meta.mode = S_IFREG | (mode & 0777);
-  payload->meta.size = 0;
+  ret = -EEXIST;
+  if (find_child(storage, parent, name))
+    goto out_unlock;
 
-  node->parent_ino = parent;
-  strncpy(node->name, name, NAME_MAX);
-  node->name[NAME_MAX] = '\0';
+  vtfs_ino_t ino = atomic_long_inc_return(&storage->next_ino);
+  struct vtfs_ram_inode_payload* payload = alloc_payload(storage, ino, parent, type, mode);
+  if (IS_ERR(payload)) {
+    ret = PTR_ERR(payload);
+    goto out_unlock;
+  }
   node->payload = payload;
 
-  *out = payload->meta;
-  return 0;
+  ret = insert_node(storage, parent_payload, node);
+  if (ret) {
+    drop_link(storage, payload);
+    goto out_unlock;
+  }
+
+  read_meta(payload, out);
+  node = NULL;
+
+out_unlock:
+  mutex_unlock(&parent_payload->dir_lock);
+  free_node(storage, node, false);
+out_put:
+  put_payload(parent_payload);
+  return ret;
+}
+
+int vtfs_ram_storage_create_file(
+    struct super_block* sb,
+    vtfs_ino_t parent,
+    const char* name,
+    umode_t mode,
+    struct vtfs_node_meta* out
+) {
+  struct vtfs_ram_storage* storage = get_storage(sb);
+  if (!storage)
+    return -EINVAL;
+
+  return create_node(storage, parent, name, VTFS_NODE_FILE, S_IFREG | (mode & 0777), out);
 }
 
 int vtfs_ram_storage_unlink(struct super_block* sb, vtfs_ino_t parent, const char* name) {
@@ -275,33 +588,34 @@ int vtfs_ram_storage_unlink(struct super_block* sb, vtfs_ino_t parent, const cha
   if (!storage)
     return -EINVAL;
 
-  struct vtfs_ram_node* prev = NULL;
-  struct vtfs_ram_node* cur = storage->nodes_head;
+  struct vtfs_ram_inode_payload* parent_payload = get_payload(storage, parent);
+  if (!parent_payload)
+    return -ENOENT;
+
+  mutex_lock(&parent_payload->dir_lock);
 
-  while (cur) {
-    if (cur->parent_ino == parent && !strcmp(cur->name, name)) {
-      if (!cur->payload || cur->payload->meta.type != VTFS_NODE_FILE)
-        return -EPERM;
+  int ret = -ENOENT;
+  struct vtfs_ram_node* node = find_child(storage, parent, name);
+  if (!node)
+    goto out_unlock;
 
-      struct vtfs_ram_inode_payload* payload = cur->payload;
+  ret = -EPERM;
+  if (node->payload->meta.type != VTFS_NODE_FILE)
+    goto out_unlock;
 
-      // Remove the node from the list
-      if (prev)
-        prev->next = cur->next;
-      else
-        storage->nodes_head = cur->next;
+  remove_node(storage, parent_payload, node);
+  ret = 0;
 
-      // Decrement reference count
-      payload_put(payload);
+out_unlock:
+  mutex_unlock(&parent_payload->dir_lock);
+  put_payload(parent_payload);
 
-      kfree(cur);
-      return 0;
-    }
-    prev = cur;
-    cur = cur->next;
+  if (ret == 0) {
+    // Decrement link count
+    drop_link(storage, node->payload);
+    free_node(storage, node, true);
   }
-
-  return -ENOENT;
+  return ret;
 }
 
 int vtfs_ram_storage_mkdir(
@@ -315,36 +629,7 @@ int vtfs_ram_storage_mkdir(
   if (!storage)
     return -EINVAL;
 
-  if (find_child(storage, parent, name))
-    return -EEXIST;
-
-  struct vtfs_ram_node* parent_node = find_node_by_ino(storage, parent);
-  if (!parent_node || !parent_node->payload || parent_node->payload->meta.type != VTFS_NODE_DIR)
-    return -ENOTDIR;
-
-  struct vtfs_ram_inode_payload* payload = alloc_payload();
-  if (!payload)
-    return -ENOMEM;
-
-  struct vtfs_ram_node* node = alloc_node(storage);
-  if (!node) {
-    payload_put(payload);
-    return -ENOMEM;
-  }
-
-  payload->meta.ino = storage->next_ino++;
-  payload->meta.parent_ino = parent;
-  payload->meta.type = VTFS_NODE_DIR;
-  payload->meta.mode = S_IFDIR | (mode & 0777);
-  payload->meta.size = 0;
-
-  node->parent_ino = parent;
-  strncpy(node->name, name, NAME_MAX);
-  node->name[NAME_MAX] = '\0';
-  node->payload = payload;
-
-  *out = payload->meta;
-  return 0;
+  return create_node(storage, parent, name, VTFS_NODE_DIR, S_IFDIR | (mode & 0777), out);
 }
 
 int vtfs_ram_storage_rmdir(struct super_block* sb, vtfs_ino_t parent, const char* name) {
@@ -352,126 +637,313 @@ int vtfs_ram_storage_rmdir(struct super_block* sb, vtfs_ino_t parent, const char
   if (!storage)
     return -EINVAL;
 
-  struct vtfs_ram_node* dir_node = find_child(storage, parent, name);
-  if (!dir_node || !dir_node->payload)
+  struct vtfs_ram_inode_payload* parent_payload = get_payload(storage, parent);
+  if (!parent_payload)
     return -ENOENT;
 
-  if (dir_node->payload->meta.type != VTFS_NODE_DIR)
-    return -ENOTDIR;
+  struct vtfs_ram_inode_payload* dir = NULL;
+  mutex_lock(&parent_payload->dir_lock);
 
-  // Check that directory is empty
-  struct vtfs_ram_node* cur = storage->nodes_head;
-  while (cur) {
-    if (cur->parent_ino == dir_node->payload->meta.ino)
-      return -ENOTEMPTY;
-    cur = cur->next;
+  int ret = -ENOENT;
+  struct vtfs_ram_node* dir_node = find_child(storage, parent, name);
+  if (!dir_node)
+    goto out_unlock;
+
+  dir = dir_node->payload;
+  ret = -ENOTDIR;
+  if (dir->meta.type != VTFS_NODE_DIR)
+    goto out_unlock;
+
+  // Check that directory is empty and keep it that way
+  mutex_lock_nested(&dir->dir_lock, SINGLE_DEPTH_NESTING);
+  ret = -ENOTEMPTY;
+  if (xa_empty(&dir->children)) {
+    dir->dead = true;
+    ret = 0;
   }
+  mutex_unlock(&dir->dir_lock);
+  if (ret)
+    goto out_unlock;
 
   // Delete directory
-  struct vtfs_ram_node* prev = NULL;
-  cur = storage->nodes_head;
-  while (cur) {
-    if (cur == dir_node) {
-      if (prev)
-        prev->next = cur->next;
-      else
-        storage->nodes_head = cur->next;
-      payload_put(cur->payload);
-      kfree(cur);
-      return 0;
+  remove_node(storage, parent_payload, dir_node);
+
+out_unlock:
+  mutex_unlock(&parent_payload->dir_lock);
+  put_payload(parent_payload);
+
+  if (ret == 0) {
+    drop_link(storage, dir);
+    free_node(storage, dir_node, true);
+  }
+  return ret;
+}
+
+// Copy up to len bytes at pos into to, stopping at the first fault. Caller
+// checked the range lies below EOF. Returns the bytes copied or an error
+static ssize_t ram_read_range(
+    struct vtfs_ram_inode_payload* payload, struct iov_iter* to, loff_t pos, size_t len
+) {
+  struct vtfs_range_lock range;
+  int ret = vtfs_range_lock(&payload->data_ranges, &range, pos, pos + len, false);
+  if (ret)
+    return ret;
+  pagefault_disable();
+
+  size_t done = 0;
+  if (payload->inlined) {
+    done = copy_to_iter(payload->inline_data + pos, len, to);
+    goto out_unlock;
+  }
+
+  // Copy data page by page into the destination vector, holes read as zeros
+  while (done < len) {
+    loff_t cur = pos + done;
+    size_t page_offset = offset_in_page(cur);
+    size_t chunk = min_t(size_t, PAGE_SIZE - page_offset, len - done);
+    struct page* page = xa_load(&payload->pages, cur >> PAGE_SHIFT);
+    size_t copied;
+
+    if (page) {
+      copied = copy_page_to_iter(page, page_offset, chunk, to);
+    } else {
+      copied = iov_iter_zero(chunk, to);
     }
-    prev = cur;
-    cur = cur->next;
+
+    done += copied;
+    if (copied < chunk)
+      break;
   }
 
-  return -ENOENT;
+out_unlock:
+  pagefault_enable();
+  vtfs_range_unlock(&payload->data_ranges, &range);
+  return done;
 }
 
 ssize_t vtfs_ram_storage_read(
-    struct super_block* sb, vtfs_ino_t ino, char* buffer, size_t len, loff_t* offset
+    struct super_block* sb, vtfs_ino_t ino, struct iov_iter* to, loff_t* offset
 ) {
   struct vtfs_ram_storage* storage = get_storage(sb);
   if (!storage)
     return -EINVAL;
 
-  struct vtfs_ram_inode_payload* payload = find_payload_by_ino(storage, ino);
+  size_t len = iov_iter_count(to);
+  int ret = vtfs_validate_io_params(*offset, len, NULL);
+  if (ret)
+    return ret;
+
+  struct vtfs_ram_inode_payload* payload = get_payload(storage, ino);
   if (!payload)
     return -ENOENT;
 
-  if (payload->meta.type != VTFS_NODE_FILE)
+  if (payload->meta.type != VTFS_NODE_FILE) {
+    put_payload(payload);
     return -EISDIR;
+  }
 
-  int ret = vtfs_validate_io_params(*offset, len, NULL);
-  if (ret)
-    return ret;
+  // Calculate how much we can read. Only that much is locked: the tail an
+  // appender is filling past the snapshot must not hold us up
+  loff_t size = READ_ONCE(payload->meta.size);
+  size_t to_read = 0;
+  if (*offset < size) {
+    size_t available = size - *offset;
+    to_read = (len < available) ? len : available;
+  }
+
+  // The destination may be a mapping of this very file. A fault taken
+  // under the range lock would read the file again and queue behind a
+  // writer waiting for our range: fault it in first and copy with faults
+  // off, going round again for pages reclaimed in between
+  size_t done = 0;
+  ssize_t err = -EFAULT;
+  while (done < to_read) {
+    size_t left = to_read - done;
+    if (fault_in_iov_iter_writeable(to, left) == left)
+      break;
+    ssize_t copied = ram_read_range(payload, to, *offset + done, left);
+    if (copied < 0) {
+      err = copied;
+      break;
+    }
+    done += copied;
+  }
+  put_payload(payload);
 
-  if (*offset >= payload->meta.size)
+  if (to_read == 0)
     return 0;  // EOF
+  if (done == 0)
+    return err;
 
-  // Calculate how much we can read
-  size_t available = payload->meta.size - *offset;
-  size_t to_read = (len < available) ? len : available;
+  *offset += done;
+  return done;
+}
 
-  if (to_read == 0)
-    return 0;
+// Write up to len bytes of from at pos, stopping at the first fault.
+// Returns the bytes written or an error
+static ssize_t ram_write_range(
+    struct vtfs_ram_inode_payload* payload, struct iov_iter* from, loff_t pos, size_t len
+) {
+  // Extending the file only locks the new tail, readers below it go on
+  struct vtfs_range_lock range;
+  loff_t new_size = pos + len;
+  loff_t lock_start = pos, lock_end = new_size;
+  size_t done = 0;
+  ssize_t err = 0;
+relock:
+  err = vtfs_range_lock(&payload->data_ranges, &range, lock_start, lock_end, true);
+  if (err)
+    return done ? done : err;
+
+  if (payload->inlined) {
+    if (new_size <= VTFS_RAM_INLINE_DATA) {
+      pagefault_disable();
+      done = copy_from_iter(payload->inline_data + pos, len, from);
+      pagefault_enable();
+      goto out_extend;
+    }
+
+    // Outgrowing the inline area: retake the lock over the whole file
+    if (lock_end != LLONG_MAX) {
+      vtfs_range_unlock(&payload->data_ranges, &range);
+      lock_start = 0;
+      lock_end = LLONG_MAX;
+      goto relock;
+    }
+
+    err = promote_inline(payload);
+    if (err)
+      goto out_unlock;
+  }
+
+  // Only the pages covered by the write are touched, missing ones are allocated zeroed
+  while (done < len) {
+    loff_t cur = pos + done;
+    size_t page_offset = offset_in_page(cur);
+    size_t chunk = min_t(size_t, PAGE_SIZE - page_offset, len - done);
+    pgoff_t index = cur >> PAGE_SHIFT;
+
+    struct page* page = get_page_for_write(payload, index);
+    if (IS_ERR(page)) {
+      err = PTR_ERR(page);
+      break;
+    }
 
-  // Copy data from kernel space to user space
-  if (copy_to_user(buffer, payload->data + *offset, to_read))
-    return -EFAULT;
+    pagefault_disable();
+    size_t copied = copy_page_from_iter(page, page_offset, chunk, from);
+    pagefault_enable();
 
-  *offset += to_read;
-  return to_read;
+    done += copied;
+    if (copied < chunk)
+      break;
+  }
+
+out_extend:
+  if (done)
+    extend_size(payload, pos + done);
+
+out_unlock:
+  vtfs_range_unlock(&payload->data_ranges, &range);
+  return done ? done : err;
 }
 
 ssize_t vtfs_ram_storage_write(
-    struct super_block* sb, vtfs_ino_t ino, const char* buffer, size_t len, loff_t* offset
+    struct super_block* sb, vtfs_ino_t ino, struct iov_iter* from, loff_t* offset
 ) {
   struct vtfs_ram_storage* storage = get_storage(sb);
   if (!storage)
     return -EINVAL;
 
-  struct vtfs_ram_inode_payload* payload = find_payload_by_ino(storage, ino);
-  if (!payload)
-    return -ENOENT;
-
-  if (payload->meta.type != VTFS_NODE_FILE)
-    return -EISDIR;
-
+  size_t len = iov_iter_count(from);
   loff_t new_size;
   int ret = vtfs_validate_io_params(*offset, len, &new_size);
   if (ret)
     return ret;
+  if (len == 0)
+    return 0;
 
-  // Allocate or reallocate data buffer if needed
-  if (new_size > payload->capacity) {
-    size_t new_capacity = new_size * 2;
-    if (new_capacity < 1024)
-      new_capacity = 1024;  // Minimum 1KB
+  struct vtfs_ram_inode_payload* payload = get_payload(storage, ino);
+  if (!payload)
+    return -ENOENT;
 
-    char* new_data = krealloc(payload->data, new_capacity, GFP_KERNEL);
-    if (!new_data)
-      return -ENOMEM;
+  if (payload->meta.type != VTFS_NODE_FILE) {
+    put_payload(payload);
+    return -EISDIR;
+  }
 
-    if (payload->capacity > 0) {
-      memset(new_data + payload->capacity, 0, new_capacity - payload->capacity);
-    } else {
-      memset(new_data, 0, new_capacity);
+  // Same as for reads: the source may map this file, so it is faulted in
+  // up front and copied with faults off, like generic_perform_write does
+  size_t done = 0;
+  ssize_t err = -EFAULT;
+  while (done < len) {
+    size_t left = len - done;
+    if (fault_in_iov_iter_readable(from, left) == left) {
+      err = -EFAULT;
+      break;
+    }
+    ssize_t written = ram_write_range(payload, from, *offset + done, left);
+    if (written < 0) {
+      err = written;
+      break;
     }
+    done += written;
+  }
+  put_payload(payload);
+
+  if (done == 0)
+    return err;
+
+  *offset += done;
+  return done;
+}
+
+loff_t vtfs_ram_storage_seek_hole_data(
+    struct super_block* sb, vtfs_ino_t ino, loff_t offset, int whence
+) {
+  struct vtfs_ram_storage* storage = get_storage(sb);
+  if (!storage)
+    return -EINVAL;
+
+  struct vtfs_ram_inode_payload* payload = get_payload(storage, ino);
+  if (!payload)
+    return -ENOENT;
 
-    payload->data = new_data;
-    payload->capacity = new_capacity;
+  loff_t pos = -EISDIR;
+  if (payload->meta.type != VTFS_NODE_FILE)
+    goto out;
+
+  // Pages are never removed from a live file, no range lock is needed
+  loff_t size = READ_ONCE(payload->meta.size);
+  pos = -ENXIO;
+  if (offset < 0 || offset >= size)
+    goto out;
+
+  // Inline data has no holes
+  if (smp_load_acquire(&payload->inlined)) {
+    pos = whence == SEEK_DATA ? offset : size;
+    goto out;
   }
 
-  // Copy data from user space to kernel space
-  if (copy_from_user(payload->data + *offset, buffer, len))
-    return -EFAULT;
+  unsigned long index = offset >> PAGE_SHIFT;
+  if (whence == SEEK_DATA) {
+    if (!xa_find(&payload->pages, &index, ULONG_MAX, XA_PRESENT))
+      goto out;
+  } else {
+    while (xa_load(&payload->pages, index))
+      index++;
+  }
 
-  if (new_size > payload->meta.size) {
-    payload->meta.size = new_size;
+  pos = max_t(loff_t, offset, (loff_t)index << PAGE_SHIFT);
+  if (whence == SEEK_DATA) {
+    if (pos >= size)
+      pos = -ENXIO;
+  } else {
+    pos = min_t(loff_t, pos, size);  // There is always a hole at EOF
   }
 
-  *offset += len;
-  return len;
+out:
+  put_payload(payload);
+  return pos;
 }
 
 int vtfs_ram_storage_link(
@@ -481,33 +953,57 @@ int vtfs_ram_storage_link(
   if (!storage)
     return -EINVAL;
 
-  struct vtfs_ram_node* target_node = find_node_by_ino(storage, target_ino);
-  if (!target_node || !target_node->payload)
+  struct vtfs_ram_inode_payload* target = get_payload(storage, target_ino);
+  if (!target)
     return -ENOENT;
 
-  if (target_node->payload->meta.type != VTFS_NODE_FILE)
-    return -EPERM;  // Hard links only for files
+  int ret = -EPERM;  // Hard links only for files
+  if (target->meta.type != VTFS_NODE_FILE)
+    goto out_put_target;
 
-  struct vtfs_ram_node* parent_node = find_node_by_ino(storage, parent);
-  if (!parent_node || !parent_node->payload || parent_node->payload->meta.type != VTFS_NODE_DIR)
-    return -ENOTDIR;
-
-  if (find_child(storage, parent, name))
-    return -EEXIST;
+  struct vtfs_ram_inode_payload* parent_payload = get_payload(storage, parent);
+  ret = -ENOTDIR;
+  if (!parent_payload)
+    goto out_put_target;
+  if (parent_payload->meta.type != VTFS_NODE_DIR)
+    goto out_put_parent;
 
-  struct vtfs_ram_node* node = alloc_node(storage);
+  struct vtfs_ram_node* node = alloc_node(storage, parent, name);
+  ret = -ENOMEM;
   if (!node)
-    return -ENOMEM;
+    goto out_put_parent;
+  node->payload = target;  // Share the same payload
 
-  // Increment reference count
-  payload_get(target_node->payload);
+  mutex_lock(&parent_payload->dir_lock);
 
-  node->parent_ino = parent;
-  strncpy(node->name, name, NAME_MAX);
-  node->name[NAME_MAX] = '\0';
-  node->payload = target_node->payload;  // Share the same payload
+  ret = -ENOENT;
+  if (parent_payload->dead)
+    goto out_unlock;
 
-  return 0;
+  ret = -EEXIST;
+  if (find_child(storage, parent, name))
+    goto out_unlock;
+
+  // Increment link count, unless the last link is already gone
+  ret = -ENOENT;
+  if (!atomic_inc_not_zero(&target->nlink))
+    goto out_unlock;
+
+  ret = insert_node(storage, parent_payload, node);
+  if (ret) {
+    drop_link(storage, target);
+    goto out_unlock;
+  }
+  node = NULL;
+
+out_unlock:
+  mutex_unlock(&parent_payload->dir_lock);
+  free_node(storage, node, false);
+out_put_parent:
+  put_payload(parent_payload);
+out_put_target:
+  put_payload(target);
+  return ret;
 }
 
 unsigned int vtfs_ram_storage_count_links(struct super_block* sb, vtfs_ino_t ino) {
@@ -515,11 +1011,68 @@ unsigned int vtfs_ram_storage_count_links(struct super_block* sb, vtfs_ino_t ino
   if (!storage)
     return 0;
 
-  return count_links_to_ino(storage, ino);
+  rcu_read_lock();
+  struct vtfs_ram_inode_payload* payload = xa_load(&storage->inodes, ino);
+  unsigned int count = payload ? atomic_read(&payload->nlink) : 0;
+  rcu_read_unlock();
+
+  return count;
+}
+
+int vtfs_ram_storage_show_stats(struct super_block* sb, struct seq_file* m) {
+  struct vtfs_ram_storage* storage = get_storage(sb);
+  if (!storage)
+    return -EINVAL;
+
+  long inodes = atomic_long_read(&storage->nr_inodes);
+  long bytes = atomic_long_read(&storage->meta_bytes);
+  seq_printf(
+      m, " inodes=%ld meta_bytes=%ld bytes_per_inode=%ld", inodes, bytes,
+      inodes ? bytes / inodes : 0
+  );
+  return 0;
+}
+
+int vtfs_ram_storage_global_init(void) {
+  // Small file data lives in the file payload, directories don't carry it
+  vtfs_ram_file_cachep = kmem_cache_create(
+      "vtfs_ram_file", sizeof(struct vtfs_ram_inode_payload),
+      __alignof__(struct vtfs_ram_inode_payload), SLAB_ACCOUNT, NULL
+  );
+  if (!vtfs_ram_file_cachep)
+    return -ENOMEM;
+
+  vtfs_ram_dir_cachep = kmem_cache_create(
+      "vtfs_ram_dir", VTFS_RAM_DIR_PAYLOAD_SIZE, __alignof__(struct vtfs_ram_inode_payload),
+      SLAB_ACCOUNT, NULL
+  );
+  if (!vtfs_ram_dir_cachep)
+    goto err_file;
+
+  vtfs_ram_node_cachep = KMEM_CACHE(vtfs_ram_node, SLAB_ACCOUNT);
+  if (!vtfs_ram_node_cachep)
+    goto err_dir;
+  return 0;
+
+err_dir:
+  kmem_cache_destroy(vtfs_ram_dir_cachep);
+err_file:
+  kmem_cache_destroy(vtfs_ram_file_cachep);
+  return -ENOMEM;
+}
+
+void vtfs_ram_storage_global_exit(void) {
+  rcu_barrier();  // Wait for RCU-deferred frees
+  kmem_cache_destroy(vtfs_ram_node_cachep);
+  kmem_cache_destroy(vtfs_ram_dir_cachep);
+  kmem_cache_destroy(vtfs_ram_file_cachep);
 }
 
 // Ops struct
 static const struct vtfs_storage_ops ram_storage_ops = {
+    .flags = VTFS_STORAGE_PAGE_CACHE | VTFS_STORAGE_PARALLEL_IO,
+    .global_init = vtfs_ram_storage_global_init,
+    .global_exit = vtfs_ram_storage_global_exit,
     .init = vtfs_ram_storage_init,
     .shutdown = vtfs_ram_storage_shutdown,
     .get_root = vtfs_ram_storage_get_root,
@@ -531,8 +1084,10 @@ static const struct vtfs_storage_ops ram_storage_ops = {
     .rmdir = vtfs_ram_storage_rmdir,
     .read = vtfs_ram_storage_read,
     .write = vtfs_ram_storage_write,
+    .seek_hole_data = vtfs_ram_storage_seek_hole_data,
     .link = vtfs_ram_storage_link,
     ._count_links = vtfs_ram_storage_count_links,
+    .show_stats = vtfs_ram_storage_show_stats,
 };
 
 const struct vtfs_storage_ops* vtfs_get_ram_storage_ops(void) {
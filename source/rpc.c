@@ -0,0 +1,220 @@
+#include "rpc.h"
+#include "buf_pool.h"
+
+#include <linux/errno.h>
+#include <linux/net.h>
+#include <linux/slab.h>
+#include <linux/socket.h>
+#include <linux/string.h>
+#include <linux/uio.h>
+#include <linux/unaligned.h>
+
+// Everything but the payload goes into one buffer: header, method, token, args
+static void *build_header(const char *token, const char *method,
+                          size_t payload_len, size_t arg_size, va_list args,
+                          size_t *header_len) {
+  size_t method_len = strlen(method);
+  size_t token_len = strlen(token);
+  if (method_len > U8_MAX || token_len > U8_MAX) {
+    return ERR_PTR(-ENAMETOOLONG);
+  }
+
+  // First pass sizes the frame
+  size_t len = sizeof(struct vtfs_rpc_frame) + 1 + method_len + 1 + token_len + 2;
+  va_list sizing;
+  va_copy(sizing, args);
+  for (size_t i = 0; i < arg_size; i++) {
+    size_t name_len = strlen(va_arg(sizing, char *));
+    size_t value_len = strlen(va_arg(sizing, char *));
+    if (name_len > U8_MAX || value_len > U16_MAX) {
+      va_end(sizing);
+      return ERR_PTR(-E2BIG);
+    }
+    len += 1 + name_len + 2 + value_len;
+  }
+  va_end(sizing);
+  len += 4;
+
+  char *buffer = vtfs_buf_get(&vtfs_small_bufs, len);
+  if (buffer == NULL) {
+    return ERR_PTR(-ENOMEM);
+  }
+
+  char *p = buffer;
+  put_unaligned_le32(VTFS_RPC_MAGIC, p);
+  put_unaligned_le32(len - sizeof(struct vtfs_rpc_frame) + payload_len, p + 4);
+  p += sizeof(struct vtfs_rpc_frame);
+
+  *p++ = method_len;
+  memcpy(p, method, method_len);
+  p += method_len;
+  *p++ = token_len;
+  memcpy(p, token, token_len);
+  p += token_len;
+  put_unaligned_le16(arg_size, p);
+  p += 2;
+
+  for (size_t i = 0; i < arg_size; i++) {
+    const char *name = va_arg(args, char *);
+    const char *value = va_arg(args, char *);
+    size_t name_len = strlen(name);
+    size_t value_len = strlen(value);
+
+    *p++ = name_len;
+    memcpy(p, name, name_len);
+    p += name_len;
+    put_unaligned_le16(value_len, p);
+    p += 2;
+    memcpy(p, value, value_len);
+    p += value_len;
+  }
+  put_unaligned_le32(payload_len, p);
+
+  *header_len = len;
+  return buffer;
+}
+
+static int recv_exact(struct socket *sock, void *buffer, size_t len) {
+  struct msghdr msg = {};
+  struct kvec vec = {.iov_base = buffer, .iov_len = len};
+
+  int ret = kernel_recvmsg(sock, &msg, &vec, 1, len, MSG_WAITALL);
+  if (ret < 0) {
+    return ret;
+  }
+  return ret == len ? 0 : -ECONNRESET;
+}
+
+// Receive exactly len bytes into dest
+static int recv_to_iter(struct socket *sock, struct iov_iter *dest, size_t len) {
+  struct msghdr msg = {};
+
+  msg.msg_iter = *dest;
+  iov_iter_truncate(&msg.msg_iter, len);
+  int ret = sock_recvmsg(sock, &msg, MSG_WAITALL);
+  if (ret < 0) {
+    return ret;
+  }
+  if (ret != len) {
+    return -ECONNRESET;
+  }
+  iov_iter_advance(dest, len);
+  return 0;
+}
+
+// One request/response exchange, the server's status goes to *status and
+// the data straight into dest.
+// Returns a transport error, after which the stream is unusable.
+// -ECONNRESET before any reply byte means the connection was already dead,
+// *sent tells whether the server may have got the request anyway
+static int exchange(struct vtfs_conn *conn, struct kvec *head,
+                    const struct iov_iter *payload, struct iov_iter *dest,
+                    size_t *data_len, int64_t *status, bool *sent) {
+  struct socket *sock = conn->sock;
+  int ret = vtfs_conn_send(conn, head, payload, sent);
+  if (ret) {
+    return ret;
+  }
+
+  struct vtfs_rpc_frame frame;
+  ret = recv_exact(sock, &frame, sizeof(frame));
+  if (ret) {
+    return ret;
+  }
+
+  size_t len = le32_to_cpu(frame.len);
+  if (le32_to_cpu(frame.magic) != VTFS_RPC_MAGIC || len < sizeof(__le64)) {
+    return -EPROTO;
+  }
+  len -= sizeof(__le64);
+  if (len > iov_iter_count(dest)) {
+    return -ENOSPC;
+  }
+
+  __le64 status_le;
+  ret = recv_exact(sock, &status_le, sizeof(status_le));
+  if (ret == 0 && len) {
+    ret = recv_to_iter(sock, dest, len);
+  }
+  if (ret) {
+    return ret == -ECONNRESET ? -EIO : ret;
+  }
+
+  *status = le64_to_cpu(status_le);
+  if (data_len) {
+    *data_len = len;
+  }
+  return 0;
+}
+
+int64_t vtfs_rpc_vcall_iter(struct vtfs_conn_pool *pool, const char *token,
+                            const char *method, bool idempotent,
+                            const struct iov_iter *payload,
+                            struct iov_iter *dest, size_t *data_len,
+                            size_t arg_size, va_list args) {
+  size_t header_len;
+  size_t payload_len = payload ? iov_iter_count(payload) : 0;
+  void *header = build_header(token, method, payload_len, arg_size, args,
+                              &header_len);
+  if (IS_ERR(header)) {
+    return PTR_ERR(header);
+  }
+
+  // The payload is sent from the caller's iterator, no copy
+  struct kvec head = {.iov_base = header, .iov_len = header_len};
+
+  int64_t status = 0;
+  int error;
+  bool reused;
+  bool sent;
+  struct vtfs_conn *conn;
+  do {
+    conn = vtfs_conn_get(pool, &reused);
+    if (conn == NULL) {
+      vtfs_buf_put(&vtfs_small_bufs, header, header_len);
+      return -ECONNREFUSED;
+    }
+
+    error = exchange(conn, &head, payload, dest, data_len, &status, &sent);
+    vtfs_conn_put(pool, conn, error == 0);
+    // The server may have dropped an idle connection, retry once on a new
+    // one. A request it may have applied is only replayed if that is harmless
+  } while (error == -ECONNRESET && reused && (idempotent || !sent));
+
+  vtfs_buf_put(&vtfs_small_bufs, header, header_len);
+  if (error) {
+    return error;
+  }
+  return status;
+}
+
+int64_t vtfs_rpc_vcall(struct vtfs_conn_pool *pool, const char *token,
+                       const char *method, bool idempotent, const void *payload,
+                       size_t payload_len, char *response_buffer,
+                       size_t buffer_size, size_t *data_len, size_t arg_size,
+                       va_list args) {
+  struct kvec vec = {.iov_base = response_buffer, .iov_len = buffer_size};
+  struct kvec payload_vec = {.iov_base = (void *)payload,
+                             .iov_len = payload_len};
+  struct iov_iter dest;
+  struct iov_iter source;
+
+  iov_iter_kvec(&dest, ITER_DEST, &vec, 1, buffer_size);
+  iov_iter_kvec(&source, ITER_SOURCE, &payload_vec, 1, payload_len);
+  return vtfs_rpc_vcall_iter(pool, token, method, idempotent, &source, &dest,
+                             data_len, arg_size, args);
+}
+
+int64_t vtfs_rpc_call(struct vtfs_conn_pool *pool, const char *token,
+                      const char *method, bool idempotent, const void *payload,
+                      size_t payload_len, char *response_buffer,
+                      size_t buffer_size, size_t *data_len, size_t arg_size,
+                      ...) {
+  va_list args;
+  va_start(args, arg_size);
+  int64_t ret = vtfs_rpc_vcall(pool, token, method, idempotent, payload,
+                               payload_len, response_buffer, buffer_size,
+                               data_len, arg_size, args);
+  va_end(args);
+  return ret;
+}
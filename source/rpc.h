@@ -0,0 +1,48 @@
+#ifndef VTFS_RPC_H
+#define VTFS_RPC_H
+
+#include <linux/stdarg.h>
+#include <linux/types.h>
+#include <linux/uio.h>
+
+#include "conn_pool.h"
+
+#define VTFS_RPC_PORT 8889
+
+// Binary framed protocol, all integers little-endian.
+//
+// Request:  __le32 magic, __le32 len (bytes after this header), then
+//           u8 method_len, method, u8 token_len, token, __le16 nargs,
+//           nargs * {u8 name_len, name, __le16 value_len, value},
+//           __le32 payload_len, payload
+// Response: __le32 magic, __le32 len, then __le64 status and len - 8
+//           bytes of data
+//
+// Names and values travel raw, no percent- or base64-encoding
+#define VTFS_RPC_MAGIC 0x31525456  // "VTR1"
+
+struct vtfs_rpc_frame {
+  __le32 magic;
+  __le32 len;
+};
+
+// Same contract as vtfs_http_call, the payload is sent raw after the header
+int64_t vtfs_rpc_vcall(struct vtfs_conn_pool *pool, const char *token,
+                       const char *method, bool idempotent, const void *payload,
+                       size_t payload_len, char *response_buffer,
+                       size_t buffer_size, size_t *data_len, size_t arg_size,
+                       va_list args);
+// Same, with the payload sent from an iterator, which is left as it is,
+// and the response data received straight into dest
+int64_t vtfs_rpc_vcall_iter(struct vtfs_conn_pool *pool, const char *token,
+                            const char *method, bool idempotent,
+                            const struct iov_iter *payload,
+                            struct iov_iter *dest, size_t *data_len,
+                            size_t arg_size, va_list args);
+int64_t vtfs_rpc_call(struct vtfs_conn_pool *pool, const char *token,
+                      const char *method, bool idempotent, const void *payload,
+                      size_t payload_len, char *response_buffer,
+                      size_t buffer_size, size_t *data_len, size_t arg_size,
+                      ...);
+
+#endif // VTFS_RPC_H
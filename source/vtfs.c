@@ -1,11 +1,26 @@
 #include "vtfs.h"
 
+#include <linux/backing-dev.h>
+#include <linux/bvec.h>
+#include <linux/dcache.h>
 #include <linux/fs.h>
+#include <linux/highmem.h>
 #include <linux/init.h>
+#include <linux/jiffies.h>
 #include <linux/mnt_idmapping.h>
 #include <linux/module.h>
+#include <linux/namei.h>
+#include <linux/pagemap.h>
+#include <linux/parser.h>
 #include <linux/printk.h>
+#include <linux/sched/mm.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
 #include <linux/string.h>
+#include <linux/stringhash.h>
+#include <linux/uio.h>
+#include <linux/workqueue.h>
+#include <linux/writeback.h>
 
 #include "vtfs_interface.h"
 
@@ -20,6 +35,20 @@ MODULE_PARM_DESC(storage_type, "Storage type: 'ram' or 'net' (default: ram)");
 
 static const struct vtfs_storage_ops* storage_ops = NULL;
 
+// Seconds a remote lookup result, positive or negative, is trusted for
+#define VTFS_DEFAULT_DENTRY_TTL 3
+// Seconds remote attributes are trusted for
+#define VTFS_DEFAULT_ATTR_TTL 3
+// Entries fetched per iterate_dir_plus call
+#define VTFS_READDIR_BATCH 64
+// Most dirty folios stored with a single write on writeback
+#define VTFS_WB_BATCH_FOLIOS 256
+// Largest readahead window on remote storage, each miss is a round trip
+#define VTFS_REMOTE_RA_PAGES (4 * 1024 * 1024 / PAGE_SIZE)
+
+// Fills readahead batches of remote files off the reader's task
+static struct workqueue_struct* vtfs_ra_wq;
+
 struct inode_operations vtfs_inode_ops = {
     .lookup = vtfs_lookup,
     .create = vtfs_create,
@@ -27,6 +56,7 @@ struct inode_operations vtfs_inode_ops = {
     .mkdir = vtfs_mkdir,
     .rmdir = vtfs_rmdir,
     .link = vtfs_link,
+    .getattr = vtfs_getattr,
 };
 
 struct file_operations vtfs_dir_ops = {
@@ -34,11 +64,74 @@ struct file_operations vtfs_dir_ops = {
 };
 
 struct file_operations vtfs_file_ops = {
-    .read = vtfs_read,
-    .write = vtfs_write,
+    .read_iter = vtfs_read_iter,
+    .write_iter = vtfs_write_iter,
+    // Reads land straight in the pipe pages, with no user space round trip
+    .splice_read = copy_splice_read,
+    .splice_write = iter_file_splice_write,
+    .llseek = vtfs_llseek,
+};
+
+// Regular files of local storage go through the page cache. Writes are
+// stored through, so cached folios stay clean and can be reclaimed at will
+struct file_operations vtfs_cached_file_ops = {
+    .read_iter = generic_file_read_iter,
+    .write_iter = vtfs_cached_write_iter,
+    .mmap = generic_file_mmap,
+    // Cached pages are handed to the pipe by reference
+    .splice_read = filemap_splice_read,
+    .splice_write = iter_file_splice_write,
+    .fsync = vtfs_fsync,
     .llseek = vtfs_llseek,
 };
 
+// Remote files read through the page cache but write straight to storage,
+// dropping the cached copy of what they overwrite
+struct file_operations vtfs_remote_file_ops = {
+    .open = vtfs_open,
+    .read_iter = generic_file_read_iter,
+    .write_iter = vtfs_write_iter,
+    .mmap = generic_file_mmap,
+    .splice_read = filemap_splice_read,
+    .splice_write = iter_file_splice_write,
+    .fsync = vtfs_fsync,
+    .llseek = vtfs_llseek,
+};
+
+// cache=writeback: writes only dirty the page cache. Contiguous dirty folios
+// reach storage together on fsync, close or when the flusher finds them old
+struct file_operations vtfs_writeback_file_ops = {
+    .open = vtfs_open,
+    .flush = vtfs_flush,
+    .read_iter = generic_file_read_iter,
+    .write_iter = generic_file_write_iter,
+    .mmap = generic_file_mmap,
+    .splice_read = filemap_splice_read,
+    .splice_write = iter_file_splice_write,
+    .fsync = vtfs_fsync,
+    .llseek = vtfs_llseek,
+};
+
+// Only used for storages whose namespace may change behind our back
+const struct dentry_operations vtfs_dentry_ops = {
+    .d_revalidate = vtfs_d_revalidate,
+};
+
+const struct super_operations vtfs_super_ops = {
+    .statfs = simple_statfs,
+    .evict_inode = vtfs_evict_inode,
+    .show_stats = vtfs_show_stats,
+};
+
+const struct address_space_operations vtfs_aops = {
+    .read_folio = vtfs_read_folio,
+    .readahead = vtfs_readahead,
+    .write_begin = vtfs_write_begin,
+    .write_end = vtfs_write_end,
+    .writepages = vtfs_writepages,
+    .dirty_folio = filemap_dirty_folio,
+};
+
 static int __init vtfs_init(void) {
   // Select implementation
   if (strcmp(storage_type, "net") == 0) {
@@ -54,15 +147,35 @@ static int __init vtfs_init(void) {
     return -EINVAL;
   }
 
-  int ret = register_filesystem(&vtfs_fs_type);
+  vtfs_ra_wq = alloc_workqueue("vtfs_ra", WQ_UNBOUND, 0);
+  if (!vtfs_ra_wq)
+    return -ENOMEM;
+
+  int ret = 0;
+  if (storage_ops->global_init) {
+    ret = storage_ops->global_init();
+    if (ret) {
+      LOG("Failed to init storage: %d\n", ret);
+      destroy_workqueue(vtfs_ra_wq);
+      return ret;
+    }
+  }
+
+  ret = register_filesystem(&vtfs_fs_type);
   if (ret) {
     LOG("Failed to register filesystem: %d\n", ret);
+    if (storage_ops->global_exit)
+      storage_ops->global_exit();
+    destroy_workqueue(vtfs_ra_wq);
   }
   return ret;
 }
 
 static void __exit vtfs_exit(void) {
   unregister_filesystem(&vtfs_fs_type);
+  if (storage_ops->global_exit)
+    storage_ops->global_exit();
+  destroy_workqueue(vtfs_ra_wq);
   LOG("VTFS left the kernel\n");
 }
 
@@ -75,8 +188,9 @@ struct file_system_type vtfs_fs_type = {
 struct dentry* vtfs_mount(
     struct file_system_type* fs_type, int flags, const char* token, void* data
 ) {
-  struct dentry* ret = mount_nodev(fs_type, flags, data, vtfs_fill_super);
-  if (ret == NULL) {
+  struct vtfs_mount_data mount_data = {.token = token, .options = data};
+  struct dentry* ret = mount_nodev(fs_type, flags, &mount_data, vtfs_fill_super);
+  if (IS_ERR(ret)) {
     printk(KERN_ERR "[vtfs] Can't mount file system\n");
   } else {
     printk(KERN_INFO "[vtfs] Mounted successfully\n");
@@ -84,10 +198,111 @@ struct dentry* vtfs_mount(
   return ret;
 }
 
+enum {
+  Opt_token,
+  Opt_dentry_ttl,
+  Opt_attr_ttl,
+  Opt_proto_http,
+  Opt_proto_rpc,
+  Opt_cache_writethrough,
+  Opt_cache_writeback,
+  Opt_err,
+};
+
+static const match_table_t vtfs_mount_tokens = {
+    {Opt_token, "token=%s"},
+    {Opt_dentry_ttl, "dentry_ttl=%u"},
+    {Opt_attr_ttl, "attr_ttl=%u"},
+    {Opt_proto_http, "proto=http"},
+    {Opt_proto_rpc, "proto=rpc"},
+    {Opt_cache_writethrough, "cache=writethrough"},
+    {Opt_cache_writeback, "cache=writeback"},
+    {Opt_err, NULL},
+};
+
+// Parse comma separated mount options. The token defaults to the mount source
+static int vtfs_parse_options(char* options, const char** token, struct vtfs_sb_info* sbi) {
+  substring_t args[MAX_OPT_ARGS];
+  unsigned int value;
+  char* p;
+
+  if (!options)
+    return 0;
+
+  while ((p = strsep(&options, ",")) != NULL) {
+    if (!*p)
+      continue;
+
+    switch (match_token(p, vtfs_mount_tokens, args)) {
+    case Opt_token:
+      *token = args[0].from;  // p is NUL-terminated by strsep
+      break;
+    case Opt_dentry_ttl:
+      if (match_uint(&args[0], &value))
+        return -EINVAL;
+      sbi->dentry_ttl = (unsigned long)value * HZ;
+      break;
+    case Opt_attr_ttl:
+      if (match_uint(&args[0], &value))
+        return -EINVAL;
+      sbi->attr_ttl = (unsigned long)value * HZ;
+      break;
+    case Opt_proto_http:
+      sbi->proto = VTFS_PROTO_HTTP;
+      break;
+    case Opt_proto_rpc:
+      sbi->proto = VTFS_PROTO_RPC;
+      break;
+    case Opt_cache_writethrough:
+      sbi->writeback = false;
+      break;
+    case Opt_cache_writeback:
+      sbi->writeback = true;
+      break;
+    default:
+      printk(KERN_ERR "[vtfs] Unknown mount option: %s\n", p);
+      return -EINVAL;
+    }
+  }
+  return 0;
+}
+
 int vtfs_fill_super(struct super_block* sb, void* data, int silent) {
-  const char* token = (const char*)data;
+  struct vtfs_mount_data* mount_data = data;
+  const char* token = mount_data->token;
+
+  // Freed by vtfs_kill_sb, which also runs when we fail below
+  struct vtfs_sb_info* sbi = kzalloc(sizeof(*sbi), GFP_KERNEL);
+  if (!sbi)
+    return -ENOMEM;
+  sbi->dentry_ttl = VTFS_DEFAULT_DENTRY_TTL * HZ;
+  sbi->attr_ttl = VTFS_DEFAULT_ATTR_TTL * HZ;
+  sb->s_fs_info = sbi;
+
+  int ret = vtfs_parse_options(mount_data->options, &token, sbi);
+  if (ret)
+    return ret;
 
-  int ret = storage_ops->init(sb, token);
+  sb->s_maxbytes = MAX_LFS_FILESIZE;
+  sb->s_blocksize = PAGE_SIZE;
+  sb->s_blocksize_bits = PAGE_SHIFT;
+  sb->s_op = &vtfs_super_ops;
+  if (storage_ops->flags & VTFS_STORAGE_REMOTE)
+    sb->s_d_op = &vtfs_dentry_ops;
+
+  // A real bdi lets the flusher write back pages dirtied through mmap
+  ret = super_setup_bdi(sb);
+  if (ret) {
+    printk(KERN_ERR "[vtfs] Failed to setup bdi: %d\n", ret);
+    return ret;
+  }
+  if (storage_ops->flags & VTFS_STORAGE_REMOTE) {
+    // Readahead ramps its window up to this on sequential access
+    sb->s_bdi->ra_pages = VTFS_REMOTE_RA_PAGES;
+    sb->s_bdi->io_pages = VTFS_REMOTE_RA_PAGES;
+  }
+
+  ret = storage_ops->init(sb, token);
   if (ret) {
     printk(KERN_ERR "[vtfs] Failed to init storage: %d\n", ret);
     return ret;
@@ -105,18 +320,13 @@ int vtfs_fill_super(struct super_block* sb, void* data, int silent) {
       (unsigned long long)root_meta.ino, (unsigned long long)root_meta.parent_ino,
       (int)root_meta.type, root_meta.mode, (long long)root_meta.size);
 
-  struct inode* inode = vtfs_get_inode(sb, NULL, root_meta.mode, root_meta.ino);
-  if (!inode) {
+  struct inode* inode = vtfs_iget(sb, &root_meta);
+  if (IS_ERR(inode)) {
     printk(KERN_ERR "[vtfs] Failed to create root inode\n");
     storage_ops->shutdown(sb);
-    return -ENOMEM;
+    return PTR_ERR(inode);
   }
 
-  inode->i_size = root_meta.size;
-  set_nlink(inode, 2);  // Directories have 2 links: one for itself, one for "."
-  inode->i_op = &vtfs_inode_ops;
-  inode->i_fop = &vtfs_dir_ops;
-
   printk(KERN_INFO "[vtfs] Created root inode, calling d_make_root\n");
   sb->s_root = d_make_root(inode);
   if (sb->s_root == NULL) {
@@ -130,23 +340,120 @@ int vtfs_fill_super(struct super_block* sb, void* data, int silent) {
   return 0;
 }
 
-struct inode* vtfs_get_inode(
-    struct super_block* sb, const struct inode* dir, umode_t mode, int i_ino
-) {
-  struct inode* inode = new_inode(sb);
-  if (inode != NULL) {
-    inode_init_owner(&nop_mnt_idmap, inode, dir, mode);
-    inode->i_mode = mode;
-    inode->i_ino = i_ino;
+// Find the in-core inode of meta->ino, building it from meta on first use.
+// Every dentry of the node, hard links included, shares that one inode
+struct inode* vtfs_iget(struct super_block* sb, const struct vtfs_node_meta* meta) {
+  struct inode* inode = iget_locked(sb, meta->ino);
+  if (!inode)
+    return ERR_PTR(-ENOMEM);
+
+  if (!(inode->i_state & I_NEW)) {
+    // The storage reused the number of a node we still hold
+    if (inode_wrong_type(inode, meta->mode)) {
+      iput(inode);
+      return ERR_PTR(-ESTALE);
+    }
+    return inode;
+  }
+
+  inode_init_owner(&nop_mnt_idmap, inode, NULL, meta->mode);
+  inode->i_mode = meta->mode;
+  i_size_write(inode, meta->size);
+  if (meta->type == VTFS_NODE_DIR) {
+    set_nlink(inode, 2);  // Directories have 2 links: one for itself, one for "."
+    inode->i_op = &vtfs_inode_ops;
+    inode->i_fop = &vtfs_dir_ops;
+  } else {
+    if (meta->nlink) {
+      set_nlink(inode, meta->nlink);
+    } else if (storage_ops->_count_links) {
+      set_nlink(inode, storage_ops->_count_links(sb, meta->ino));
+    } else {
+      set_nlink(inode, 1);
+    }
+    vtfs_init_file_inode(inode);
   }
+
+  unlock_new_inode(inode);
   return inode;
 }
 
+// Wire file operations of a regular file inode
+void vtfs_init_file_inode(struct inode* inode) {
+  inode->i_op = &vtfs_inode_ops;
+  if (storage_ops->flags & VTFS_STORAGE_PAGE_CACHE) {
+    if (!(storage_ops->flags & VTFS_STORAGE_REMOTE))
+      inode->i_fop = &vtfs_cached_file_ops;
+    else if (VTFS_SB(inode->i_sb)->writeback)
+      inode->i_fop = &vtfs_writeback_file_ops;
+    else
+      inode->i_fop = &vtfs_remote_file_ops;
+    inode->i_mapping->a_ops = &vtfs_aops;
+  } else {
+    inode->i_fop = &vtfs_file_ops;
+  }
+}
+
+void vtfs_evict_inode(struct inode* inode) {
+  truncate_inode_pages_final(&inode->i_data);
+  clear_inode(inode);
+  if (storage_ops->forget)
+    storage_ops->forget(inode->i_sb, inode->i_ino);
+}
+
+int vtfs_show_stats(struct seq_file* m, struct dentry* root) {
+  if (!storage_ops->show_stats)
+    return 0;
+  return storage_ops->show_stats(root->d_sb, m);
+}
+
 void vtfs_kill_sb(struct super_block* sb) {
-  storage_ops->shutdown(sb);
+  struct vtfs_sb_info* sbi = VTFS_SB(sb);
+
+  // Evicts inodes and writes back dirty pages while the storage is still alive
+  kill_anon_super(sb);
+  if (sbi) {
+    storage_ops->shutdown(sb);
+    kfree(sbi);
+    sb->s_fs_info = NULL;
+  }
   printk(KERN_INFO "[vtfs] Super block destroyed. Unmount successfully.\n");
 }
 
+// Start the trust period of a dentry that matches storage right now
+static void vtfs_dentry_refresh(struct dentry* dentry) {
+  dentry->d_time = jiffies;
+}
+
+int vtfs_d_revalidate(
+    struct inode* dir, const struct qstr* name, struct dentry* dentry, unsigned int flags
+) {
+  struct vtfs_sb_info* sbi = VTFS_SB(dentry->d_sb);
+  struct inode* inode = d_inode_rcu(dentry);
+
+  // A stale miss must not turn a plain O_CREAT open into -EEXIST
+  bool creating = !inode && (flags & LOOKUP_CREATE) && !(flags & LOOKUP_EXCL);
+  if (!creating && time_before(jiffies, dentry->d_time + sbi->dentry_ttl))
+    return 1;
+
+  if (flags & LOOKUP_RCU)
+    return -ECHILD;
+
+  struct vtfs_node_meta meta;
+  int ret = storage_ops->lookup(dir->i_sb, dir->i_ino, name->name, &meta);
+  if (ret == -ENOENT) {
+    if (inode)
+      return 0;
+  } else if (ret) {
+    return ret;
+  } else if (!inode || inode->i_ino != meta.ino) {
+    return 0;
+  }
+
+  vtfs_dentry_refresh(dentry);
+  return 1;
+}
+
 struct dentry* vtfs_lookup(
     struct inode* parent_inode, struct dentry* child_dentry, unsigned int flag
 ) {
@@ -156,70 +463,120 @@ struct dentry* vtfs_lookup(
   );
 
   if (ret == 0) {
-    struct inode* inode = vtfs_get_inode(parent_inode->i_sb, NULL, meta.mode, meta.ino);
-    if (inode) {
-      inode->i_size = meta.size;
-      if (meta.type == VTFS_NODE_DIR) {
-        set_nlink(inode, 2);  // Directories have 2 links: one for itself, one for "."
-        inode->i_op = &vtfs_inode_ops;
-        inode->i_fop = &vtfs_dir_ops;
-      } else {
-        if (storage_ops->_count_links) {
-          unsigned int link_count = storage_ops->_count_links(parent_inode->i_sb, meta.ino);
-          set_nlink(inode, link_count);
-        } else {
-          set_nlink(inode, 1);
-        }
-        inode->i_op = &vtfs_inode_ops;
-        inode->i_fop = &vtfs_file_ops;
+    struct inode* inode = vtfs_iget(parent_inode->i_sb, &meta);
+    if (IS_ERR(inode))
+      return ERR_CAST(inode);
+    vtfs_dentry_refresh(child_dentry);
+    return d_splice_alias(inode, child_dentry);
+  }
+  if (ret != -ENOENT)
+    return ERR_PTR(ret);
+
+  // Cache the miss, so probing the same name again stays local
+  vtfs_dentry_refresh(child_dentry);
+  d_add(child_dentry, NULL);
+  return NULL;
+}
+
+// Put a listed entry into the dcache, so a following stat() needs no lookup
+static void vtfs_prime_dcache(struct dentry* parent, const struct vtfs_dirent_plus* entry) {
+  DECLARE_WAIT_QUEUE_HEAD_ONSTACK(wq);
+  struct qstr name = QSTR_INIT(entry->dirent.name, strlen(entry->dirent.name));
+  name.hash = full_name_hash(parent, name.name, name.len);
+
+  struct dentry* dentry = d_lookup(parent, &name);
+  if (dentry) {
+    // Renew it while it still names the same node, otherwise revalidate decides
+    struct inode* inode = d_inode(dentry);
+    if (inode && inode->i_ino == entry->meta.ino)
+      vtfs_dentry_refresh(dentry);
+    dput(dentry);
+    return;
+  }
+
+  dentry = d_alloc_parallel(parent, &name, &wq);
+  if (IS_ERR(dentry))
+    return;
+  if (!d_in_lookup(dentry)) {
+    // Someone else looked it up meanwhile
+    dput(dentry);
+    return;
+  }
+
+  vtfs_dentry_refresh(dentry);
+  struct dentry* alias = d_splice_alias(vtfs_iget(parent->d_sb, &entry->meta), dentry);
+  d_lookup_done(dentry);
+  if (alias && !IS_ERR(alias))
+    dput(alias);
+  dput(dentry);
+}
+
+// Read the directory in batches that carry attributes along
+static int vtfs_iterate_plus(struct file* filp, struct dir_context* ctx) {
+  struct inode* inode = file_inode(filp);
+  struct vtfs_dirent_plus* batch =
+      kvmalloc_array(VTFS_READDIR_BATCH, sizeof(*batch), GFP_KERNEL);
+  if (!batch)
+    return -ENOMEM;
+
+  int ret;
+  while (true) {
+    unsigned long storage_offset = ctx->pos - 2;
+
+    ret = storage_ops->iterate_dir_plus(
+        inode->i_sb, inode->i_ino, &storage_offset, batch, VTFS_READDIR_BATCH
+    );
+    if (ret <= 0)
+      break;
+
+    for (int i = 0; i < ret; i++) {
+      struct vtfs_dirent* dirent = &batch[i].dirent;
+      unsigned char d_type = (dirent->type == VTFS_NODE_DIR) ? DT_DIR : DT_REG;
+
+      if (!dir_emit(ctx, dirent->name, strlen(dirent->name), dirent->ino, d_type)) {
+        kvfree(batch);
+        return 0;
       }
-      d_add(child_dentry, inode);
+      vtfs_prime_dcache(filp->f_path.dentry, &batch[i]);
+      ctx->pos = batch[i].offset + 2;
     }
   }
 
-  return NULL;
+  kvfree(batch);
+  return ret == -ENOENT ? 0 : ret;
 }
 
 int vtfs_iterate(struct file* filp, struct dir_context* ctx) {
-  struct dentry* dentry = filp->f_path.dentry;
-  struct inode* inode = dentry->d_inode;
-  unsigned long offset = filp->f_pos;
-  ino_t dir_ino = inode->i_ino;
+  struct inode* inode = file_inode(filp);
 
   // Handle "." and ".."
-  if (offset == 0) {
-    if (!dir_emit(ctx, ".", 1, dir_ino, DT_DIR))
-      return 0;
-    ctx->pos++;
-    filp->f_pos = ctx->pos;
-    return 0;
-  }
-  if (offset == 1) {
-    ino_t parent_ino = dentry->d_parent->d_inode->i_ino;
-    if (!dir_emit(ctx, "..", 2, parent_ino, DT_DIR))
-      return 0;
-    ctx->pos++;
-    filp->f_pos = ctx->pos;
+  if (!dir_emit_dots(filp, ctx))
     return 0;
+
+  if (storage_ops->iterate_dir_plus) {
+    int ret = vtfs_iterate_plus(filp, ctx);
+    // Storage can't list with attributes after all, go on entry by entry
+    if (ret != -EOPNOTSUPP)
+      return ret;
   }
 
-  // Handle real files
-  unsigned long storage_offset = offset - 2;
-  struct vtfs_dirent dirent;
+  // Handle real files. Positions after the dots are storage offsets shifted by 2
+  while (true) {
+    unsigned long storage_offset = ctx->pos - 2;
+    struct vtfs_dirent dirent;
 
-  int ret = storage_ops->iterate_dir(inode->i_sb, dir_ino, &storage_offset, &dirent);
+    int ret = storage_ops->iterate_dir(inode->i_sb, inode->i_ino, &storage_offset, &dirent);
+    if (ret == -ENOENT)
+      return 0;
+    if (ret)
+      return ret;
 
-  if (ret == 0) {
     unsigned char d_type = (dirent.type == VTFS_NODE_DIR) ? DT_DIR : DT_REG;
     if (!dir_emit(ctx, dirent.name, strlen(dirent.name), dirent.ino, d_type))
       return 0;
 
-    ctx->pos++;
-    filp->f_pos = ctx->pos;
-    return 0;
+    ctx->pos = storage_offset + 2;
   }
-
-  return 0;
 }
 
 int vtfs_create(
@@ -237,21 +594,13 @@ int vtfs_create(
   if (ret)
     return ret;
 
-  struct inode* inode = vtfs_get_inode(parent_inode->i_sb, NULL, meta.mode, meta.ino);
-  if (!inode)
-    return -ENOMEM;
+  struct inode* inode = vtfs_iget(parent_inode->i_sb, &meta);
+  if (IS_ERR(inode))
+    return PTR_ERR(inode);
 
-  inode->i_size = meta.size;
-  if (storage_ops->_count_links) {
-    unsigned int link_count = storage_ops->_count_links(parent_inode->i_sb, meta.ino);
-    set_nlink(inode, link_count);
-  } else {
-    set_nlink(inode, 1);
-  }
-  inode->i_op = &vtfs_inode_ops;
-  inode->i_fop = &vtfs_file_ops;
-
-  d_add(child_dentry, inode);
+  // Lookup left a negative dentry behind, turn it positive
+  vtfs_dentry_refresh(child_dentry);
+  d_instantiate(child_dentry, inode);
   return 0;
 }
 
@@ -262,6 +611,9 @@ int vtfs_unlink(struct inode* parent_inode, struct dentry* child_dentry) {
   if (ret == 0 && target_inode) {
     // Decrement link count
     drop_nlink(target_inode);
+    vtfs_dentry_refresh(child_dentry);  // Becomes a fresh negative entry
+    if (storage_ops->forget)
+      storage_ops->forget(parent_inode->i_sb, target_inode->i_ino);
   }
 
   return ret;
@@ -278,21 +630,96 @@ struct dentry* vtfs_mkdir(
   if (ret)
     return ERR_PTR(ret);
 
-  struct inode* inode = vtfs_get_inode(parent_inode->i_sb, NULL, meta.mode, meta.ino);
-  if (!inode)
-    return ERR_PTR(-ENOMEM);
-
-  inode->i_size = meta.size;
-  set_nlink(inode, 2);  // Directories have 2 links: one for itself, one for "."
-  inode->i_op = &vtfs_inode_ops;
-  inode->i_fop = &vtfs_dir_ops;
+  struct inode* inode = vtfs_iget(parent_inode->i_sb, &meta);
+  if (IS_ERR(inode))
+    return ERR_CAST(inode);
 
-  d_add(child_dentry, inode);
+  vtfs_dentry_refresh(child_dentry);
+  d_instantiate(child_dentry, inode);
   return NULL;
 }
 
 int vtfs_rmdir(struct inode* parent_inode, struct dentry* child_dentry) {
-  return storage_ops->rmdir(parent_inode->i_sb, parent_inode->i_ino, child_dentry->d_name.name);
+  int ret = storage_ops->rmdir(parent_inode->i_sb, parent_inode->i_ino, child_dentry->d_name.name);
+  if (ret == 0 && storage_ops->forget)
+    storage_ops->forget(parent_inode->i_sb, d_inode(child_dentry)->i_ino);
+  return ret;
+}
+
+// Bring a cached inode in line with attributes fetched from storage
+static void vtfs_refresh_inode(
+    struct inode* inode, const struct vtfs_node_meta* meta, unsigned int nlink
+) {
+  inode_lock(inode);
+  // Files never shrink, so a size older than our own writes is ignored.
+  // Growth is someone else's write, which may have touched cached data too
+  if (meta->size > i_size_read(inode)) {
+    i_size_write(inode, meta->size);
+    if (S_ISREG(inode->i_mode))
+      invalidate_mapping_pages(inode->i_mapping, 0, -1);
+  }
+  if (!S_ISDIR(inode->i_mode) && nlink)
+    set_nlink(inode, nlink);
+  inode_unlock(inode);
+}
+
+// Bring the inode of dentry up to date with storage, if storage can tell.
+// *fetched tells whether storage was asked rather than a cache
+static int vtfs_sync_attrs(struct dentry* dentry, bool* fetched) {
+  struct inode* inode = d_inode(dentry);
+
+  // Unhashed dentries belong to removed files, nothing left to ask about
+  *fetched = false;
+  if (!storage_ops->getattr || IS_ROOT(dentry) || d_unhashed(dentry))
+    return 0;
+
+  struct dentry* parent = dget_parent(dentry);
+  struct vtfs_node_meta meta;
+  unsigned int nlink;
+  int ret = storage_ops->getattr(
+      inode->i_sb, d_inode(parent)->i_ino, dentry->d_name.name, inode->i_ino, &meta, &nlink,
+      fetched
+  );
+  dput(parent);
+  if (ret)
+    return ret;
+  vtfs_refresh_inode(inode, &meta, nlink);
+  return 0;
+}
+
+int vtfs_getattr(
+    struct mnt_idmap* idmap,
+    const struct path* path,
+    struct kstat* stat,
+    u32 request_mask,
+    unsigned int query_flags
+) {
+  if (!(query_flags & AT_STATX_DONT_SYNC)) {
+    bool fetched;
+    int ret = vtfs_sync_attrs(path->dentry, &fetched);
+    if (ret)
+      return ret;
+  }
+
+  generic_fillattr(idmap, request_mask, d_inode(path->dentry), stat);
+  return 0;
+}
+
+// Close-to-open: an open sees what others wrote, up to the attribute lease.
+// Files never shrink and an overwrite keeps the size, so when the lease was
+// renewed the cached data is dropped rather than trusted by size
+int vtfs_open(struct inode* inode, struct file* filp) {
+  bool fetched;
+  int ret = vtfs_sync_attrs(filp->f_path.dentry, &fetched);
+  if (ret)
+    return ret;
+
+  if (fetched && S_ISREG(inode->i_mode) && inode->i_mapping->nrpages) {
+    // Our own dirty data goes out first, it is newer than the server's
+    filemap_write_and_wait(inode->i_mapping);
+    invalidate_inode_pages2(inode->i_mapping);
+  }
+  return generic_file_open(inode, filp);
 }
 
 int vtfs_link(struct dentry* old_dentry, struct inode* parent_dir, struct dentry* new_dentry) {
@@ -322,7 +749,9 @@ int vtfs_link(struct dentry* old_dentry, struct inode* parent_dir, struct dentry
       inc_nlink(target_inode);
     }
     // Associate the new dentry with the existing inode
-    d_instantiate(new_dentry, igrab(target_inode));
+    ihold(target_inode);
+    vtfs_dentry_refresh(new_dentry);
+    d_instantiate(new_dentry, target_inode);
   }
 
   return ret;
@@ -344,55 +773,399 @@ int vtfs_validate_io_params(loff_t offset, size_t len, loff_t* new_size_out) {
 
 // Helper function to update inode size after write
 void vtfs_update_inode_size(struct inode* inode, loff_t new_size) {
-  if (new_size > inode->i_size) {
-    inode->i_size = new_size;
+  if (new_size > i_size_read(inode)) {
+    i_size_write(inode, new_size);
   }
 }
 
-ssize_t vtfs_read(struct file* filp, char __user* buffer, size_t len, loff_t* offset) {
-  struct inode* inode = file_inode(filp);
+ssize_t vtfs_read_iter(struct kiocb* iocb, struct iov_iter* to) {
+  struct inode* inode = file_inode(iocb->ki_filp);
   if (!storage_ops->read)
     return -ENOSYS;
 
-  // Use filp->f_pos as offset if offset parameter is not provided
-  loff_t pos = (offset) ? *offset : filp->f_pos;
-  ssize_t ret = storage_ops->read(inode->i_sb, inode->i_ino, buffer, len, &pos);
+  if (!iov_iter_count(to))
+    return 0;
+
+  loff_t pos = iocb->ki_pos;
+  ssize_t ret = storage_ops->read(inode->i_sb, inode->i_ino, to, &pos);
   if (ret > 0) {
-    if (offset) {
-      *offset = pos;
-    }
-    filp->f_pos = pos;
+    iocb->ki_pos = pos;
   }
   return ret;
 }
 
-ssize_t vtfs_write(struct file* filp, const char __user* buffer, size_t len, loff_t* offset) {
-  struct inode* inode = file_inode(filp);
+// A write inside the file leaves i_size alone
+static bool vtfs_write_in_place(struct kiocb* iocb, struct iov_iter* from) {
+  loff_t size = i_size_read(file_inode(iocb->ki_filp));
+  return !(iocb->ki_flags & IOCB_APPEND) && iocb->ki_pos <= size &&
+         iov_iter_count(from) <= size - iocb->ki_pos;
+}
+
+// Lock the inode for a write, returns whether the lock is shared. Storages
+// that lock by byte range run writes inside the file side by side, only
+// extending ones need the inode to themselves
+static bool vtfs_write_lock(struct kiocb* iocb, struct iov_iter* from) {
+  struct inode* inode = file_inode(iocb->ki_filp);
+
+  if ((storage_ops->flags & VTFS_STORAGE_PARALLEL_IO) && vtfs_write_in_place(iocb, from)) {
+    inode_lock_shared(inode);
+    // A truncate may have got in first
+    if (vtfs_write_in_place(iocb, from))
+      return true;
+    inode_unlock_shared(inode);
+  }
+  inode_lock(inode);
+  return false;
+}
+
+static void vtfs_write_unlock(struct inode* inode, bool shared) {
+  if (shared)
+    inode_unlock_shared(inode);
+  else
+    inode_unlock(inode);
+}
+
+ssize_t vtfs_write_iter(struct kiocb* iocb, struct iov_iter* from) {
+  struct inode* inode = file_inode(iocb->ki_filp);
   if (!storage_ops->write)
     return -ENOSYS;
 
-  // Use filp->f_pos as offset if offset parameter is not provided
-  loff_t pos = (offset) ? *offset : filp->f_pos;
-  loff_t old_pos = pos;
+  bool shared = vtfs_write_lock(iocb, from);
 
-  // Validate I/O parameters
-  loff_t new_size;
-  int ret = vtfs_validate_io_params(pos, len, &new_size);
-  if (ret)
-    return ret;
+  // Applies O_APPEND and the size limits
+  ssize_t ret = generic_write_checks(iocb, from);
+  if (ret > 0) {
+    struct address_space* mapping = inode->i_mapping;
+    loff_t pos = iocb->ki_pos;
+    loff_t end = pos + iov_iter_count(from) - 1;
+
+    // Pages dirtied through mmap must not land on top of this write later
+    ret = filemap_write_and_wait_range(mapping, pos, end);
+    if (ret == 0)
+      ret = storage_ops->write(inode->i_sb, inode->i_ino, from, &pos);
+    if (ret > 0) {
+      // Cached copies of the range are stale now
+      invalidate_inode_pages2_range(mapping, iocb->ki_pos >> PAGE_SHIFT, (pos - 1) >> PAGE_SHIFT);
+      iocb->ki_pos = pos;
+      vtfs_update_inode_size(inode, pos);
+    }
+  }
+
+  vtfs_write_unlock(inode, shared);
+
+  if (ret > 0)
+    ret = generic_write_sync(iocb, ret);
+  return ret;
+}
+
+// Buffered write through write_begin/write_end. Folio locks keep writers
+// of one page apart, so in-place writes share the inode lock here too
+ssize_t vtfs_cached_write_iter(struct kiocb* iocb, struct iov_iter* from) {
+  struct inode* inode = file_inode(iocb->ki_filp);
+  bool shared = vtfs_write_lock(iocb, from);
+
+  ssize_t ret = generic_write_checks(iocb, from);
+  if (ret > 0)
+    ret = generic_perform_write(iocb, from);
+
+  vtfs_write_unlock(inode, shared);
+
+  if (ret > 0)
+    ret = generic_write_sync(iocb, ret);
+  return ret;
+}
+
+// Fill a locked folio from storage, zeroing whatever lies past EOF
+static int vtfs_fill_folio(struct inode* inode, struct folio* folio) {
+  struct bio_vec bvec;
+  struct iov_iter iter;
+  size_t len = folio_size(folio);
+  loff_t pos = folio_pos(folio);
+
+  bvec_set_folio(&bvec, folio, len, 0);
+  iov_iter_bvec(&iter, ITER_DEST, &bvec, 1, len);
+
+  while (iov_iter_count(&iter)) {
+    ssize_t ret = storage_ops->read(inode->i_sb, inode->i_ino, &iter, &pos);
+    if (ret < 0)
+      return ret;
+    if (ret == 0)
+      break;
+  }
+
+  if (iov_iter_count(&iter))
+    folio_zero_segment(folio, len - iov_iter_count(&iter), len);
+  return 0;
+}
 
-  ssize_t written = storage_ops->write(inode->i_sb, inode->i_ino, buffer, len, &pos);
-  if (written > 0) {
-    if (offset) {
-      *offset = pos;
+// Store [pos, pos + len) of a locked folio in storage
+static int vtfs_flush_folio(struct inode* inode, struct folio* folio, loff_t pos, size_t len) {
+  struct bio_vec bvec;
+  struct iov_iter iter;
+
+  bvec_set_folio(&bvec, folio, len, offset_in_folio(folio, pos));
+  iov_iter_bvec(&iter, ITER_SOURCE, &bvec, 1, len);
+
+  while (iov_iter_count(&iter)) {
+    ssize_t ret = storage_ops->write(inode->i_sb, inode->i_ino, &iter, &pos);
+    if (ret < 0)
+      return ret;
+    if (ret == 0)
+      return -EIO;
+  }
+  return 0;
+}
+
+int vtfs_read_folio(struct file* filp, struct folio* folio) {
+  int ret = vtfs_fill_folio(folio->mapping->host, folio);
+  folio_end_read(folio, ret == 0);
+  return ret;
+}
+
+// Contiguous locked folios of one readahead batch
+struct vtfs_ra_batch {
+  struct work_struct work;
+  struct inode* inode;
+  loff_t pos;
+  unsigned int nr_folios;
+  struct bio_vec bvecs[];
+};
+
+// Fill the whole batch with one storage read, which a remote storage splits
+// into concurrent requests, and end the read of every folio. Locked folios
+// keep the mapping, and so the inode, alive until the last one is released
+static void vtfs_read_batch(struct vtfs_ra_batch* batch) {
+  struct inode* inode = batch->inode;
+  struct iov_iter iter;
+  loff_t pos = batch->pos;
+  size_t total = 0;
+  int error = 0;
+
+  for (unsigned int i = 0; i < batch->nr_folios; i++)
+    total += batch->bvecs[i].bv_len;
+  iov_iter_bvec(&iter, ITER_DEST, batch->bvecs, batch->nr_folios, total);
+
+  while (iov_iter_count(&iter)) {
+    ssize_t ret = storage_ops->read(inode->i_sb, inode->i_ino, &iter, &pos);
+    if (ret < 0) {
+      error = ret;
+      break;
     }
-    filp->f_pos = pos;
+    if (ret == 0)
+      break;  // EOF, the rest is zeroes
+  }
 
-    // Update inode size
-    loff_t actual_new_size = old_pos + written;
-    vtfs_update_inode_size(inode, actual_new_size);
+  size_t filled = total - iov_iter_count(&iter);
+  size_t start = 0;
+  for (unsigned int i = 0; i < batch->nr_folios; i++) {
+    struct folio* folio = page_folio(batch->bvecs[i].bv_page);
+    size_t len = batch->bvecs[i].bv_len;
+    bool ok = !error || start + len <= filled;
+
+    if (ok && filled < start + len)
+      folio_zero_segment(folio, filled > start ? filled - start : 0, len);
+    folio_end_read(folio, ok);
+    start += len;
   }
-  return written;
+}
+
+static void vtfs_read_batch_work(struct work_struct* work) {
+  struct vtfs_ra_batch* batch = container_of(work, struct vtfs_ra_batch, work);
+
+  vtfs_read_batch(batch);
+  kfree(batch);
+}
+
+void vtfs_readahead(struct readahead_control* rac) {
+  struct vtfs_ra_batch* batch = kmalloc(
+      struct_size(batch, bvecs, readahead_count(rac)), readahead_gfp_mask(rac->mapping)
+  );
+  // Folios left in rac are dropped and later read one by one
+  if (!batch)
+    return;
+
+  struct folio* folio;
+  batch->inode = rac->mapping->host;
+  batch->pos = readahead_pos(rac);
+  batch->nr_folios = 0;
+  while ((folio = readahead_folio(rac)))
+    bvec_set_folio(&batch->bvecs[batch->nr_folios++], folio, folio_size(folio), 0);
+
+  // A remote round trip must not hold up a reader still busy with cached data
+  if (storage_ops->flags & VTFS_STORAGE_REMOTE) {
+    INIT_WORK(&batch->work, vtfs_read_batch_work);
+    queue_work(vtfs_ra_wq, &batch->work);
+    return;
+  }
+  vtfs_read_batch(batch);
+  kfree(batch);
+}
+
+int vtfs_write_begin(
+    struct file* filp,
+    struct address_space* mapping,
+    loff_t pos,
+    unsigned int len,
+    struct folio** foliop,
+    void** fsdata
+) {
+  struct folio* folio = __filemap_get_folio(
+      mapping, pos >> PAGE_SHIFT, FGP_WRITEBEGIN, mapping_gfp_mask(mapping)
+  );
+  if (IS_ERR(folio))
+    return PTR_ERR(folio);
+
+  // A partial write needs the rest of the folio from storage
+  if (!folio_test_uptodate(folio) && len != folio_size(folio)) {
+    int ret = vtfs_fill_folio(mapping->host, folio);
+    if (ret) {
+      folio_unlock(folio);
+      folio_put(folio);
+      return ret;
+    }
+    folio_mark_uptodate(folio);
+  }
+
+  *foliop = folio;
+  return 0;
+}
+
+int vtfs_write_end(
+    struct file* filp,
+    struct address_space* mapping,
+    loff_t pos,
+    unsigned int len,
+    unsigned int copied,
+    struct folio* folio,
+    void* fsdata
+) {
+  struct inode* inode = mapping->host;
+
+  if (!folio_test_uptodate(folio)) {
+    // Short copy into a folio we never read: let the caller retry
+    if (copied < len) {
+      copied = 0;
+      goto out;
+    }
+    folio_mark_uptodate(folio);
+  }
+
+  if (copied && (storage_ops->flags & VTFS_STORAGE_REMOTE)) {
+    // Only cache=writeback writes of remote files come this way. The folio
+    // is stored later by vtfs_writepages, together with its dirty neighbours
+    folio_mark_dirty(folio);
+    vtfs_update_inode_size(inode, pos + copied);
+  } else if (copied) {
+    // Write through, so storage keeps the only copy that must stay in memory
+    int ret = vtfs_flush_folio(inode, folio, pos, copied);
+    if (ret) {
+      folio_unlock(folio);
+      folio_put(folio);
+      return ret;
+    }
+    vtfs_update_inode_size(inode, pos + copied);
+  }
+
+out:
+  folio_unlock(folio);
+  folio_put(folio);
+  return copied;
+}
+
+// Store a run of contiguous folios under writeback with one storage write
+static int vtfs_flush_batch(
+    struct inode* inode, struct bio_vec* bvecs, unsigned int nr_folios, loff_t pos, size_t len
+) {
+  struct iov_iter iter;
+  int error = 0;
+
+  iov_iter_bvec(&iter, ITER_SOURCE, bvecs, nr_folios, len);
+  while (iov_iter_count(&iter)) {
+    ssize_t ret = storage_ops->write(inode->i_sb, inode->i_ino, &iter, &pos);
+    if (ret < 0) {
+      error = ret;
+      break;
+    }
+    if (ret == 0) {
+      error = -EIO;
+      break;
+    }
+  }
+
+  if (error)
+    mapping_set_error(inode->i_mapping, error);
+  for (unsigned int i = 0; i < nr_folios; i++)
+    folio_end_writeback(page_folio(bvecs[i].bv_page));
+  return error;
+}
+
+// Folios dirtied through shared mmap or in cache=writeback mode end up here.
+// Runs of contiguous dirty folios are merged into one storage write, the
+// storage sends the folios themselves
+int vtfs_writepages(struct address_space* mapping, struct writeback_control* wbc) {
+  struct inode* inode = mapping->host;
+  // Reclaim may be what called us. Socket buffers and the like allocated
+  // on the way to storage must not recurse into the file system
+  unsigned int nofs = memalloc_nofs_save();
+  struct bio_vec single;
+  struct bio_vec* bvecs = kmalloc_array(VTFS_WB_BATCH_FOLIOS, sizeof(*bvecs), GFP_NOFS);
+  unsigned int max_folios = bvecs ? VTFS_WB_BATCH_FOLIOS : 1;
+  unsigned int nr_folios = 0;
+  loff_t batch_pos = 0;
+  size_t batch_len = 0;
+  struct folio* folio = NULL;
+  int error = 0;
+
+  if (!bvecs)
+    bvecs = &single;
+
+  while ((folio = writeback_iter(mapping, wbc, folio, &error))) {
+    loff_t pos = folio_pos(folio);
+    loff_t size = i_size_read(inode);
+
+    folio_start_writeback(folio);
+    folio_unlock(folio);
+    if (pos >= size) {
+      folio_end_writeback(folio);
+      continue;
+    }
+
+    bool contiguous = nr_folios && pos == batch_pos + batch_len;
+    if (nr_folios && (!contiguous || nr_folios == max_folios)) {
+      error = vtfs_flush_batch(inode, bvecs, nr_folios, batch_pos, batch_len);
+      nr_folios = 0;
+    }
+    if (nr_folios == 0) {
+      batch_pos = pos;
+      batch_len = 0;
+    }
+
+    // Writeback keeps the folio from going away while it waits in the batch
+    size_t len = min_t(loff_t, folio_size(folio), size - pos);
+    bvec_set_folio(&bvecs[nr_folios++], folio, len, 0);
+    batch_len += len;
+  }
+
+  if (nr_folios) {
+    int ret = vtfs_flush_batch(inode, bvecs, nr_folios, batch_pos, batch_len);
+    if (!error)
+      error = ret;
+  }
+  if (bvecs != &single)
+    kfree(bvecs);
+  memalloc_nofs_restore(nofs);
+  return error;
+}
+
+int vtfs_fsync(struct file* filp, loff_t start, loff_t end, int datasync) {
+  return file_write_and_wait_range(filp, start, end);
+}
+
+// Close-to-open: what this opener wrote is in storage once close returns
+int vtfs_flush(struct file* filp, fl_owner_t id) {
+  if (!(filp->f_mode & FMODE_WRITE))
+    return 0;
+  return filemap_write_and_wait(filp->f_mapping);
 }
 
 loff_t vtfs_llseek(struct file *filp, loff_t offset, int whence) {
@@ -409,6 +1182,19 @@ loff_t vtfs_llseek(struct file *filp, loff_t offset, int whence) {
   case SEEK_END:
       newpos = inode->i_size + offset;
       break;
+  case SEEK_DATA:
+  case SEEK_HOLE:
+      if (offset < 0 || offset >= inode->i_size)
+          return -ENXIO;
+      if (storage_ops->seek_hole_data) {
+          newpos = storage_ops->seek_hole_data(inode->i_sb, inode->i_ino, offset, whence);
+          if (newpos < 0)
+              return newpos;
+      } else {
+          // Without storage help the whole file is one data extent
+          newpos = (whence == SEEK_DATA) ? offset : inode->i_size;
+      }
+      break;
   default:
       return -EINVAL;
   }
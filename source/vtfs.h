@@ -3,12 +3,27 @@
 
 #include <linux/fs.h>
 
+#include "vtfs_interface.h"
+
 #define MODULE_NAME "vtfs"
 #define LOG(fmt, ...) pr_info("[" MODULE_NAME "]: " fmt, ##__VA_ARGS__)
 
 extern struct file_system_type vtfs_fs_type;
 extern struct inode_operations vtfs_inode_ops;
 extern struct file_operations vtfs_dir_ops;
+extern struct file_operations vtfs_file_ops;
+extern struct file_operations vtfs_cached_file_ops;
+extern struct file_operations vtfs_remote_file_ops;
+extern struct file_operations vtfs_writeback_file_ops;
+extern const struct address_space_operations vtfs_aops;
+extern const struct super_operations vtfs_super_ops;
+extern const struct dentry_operations vtfs_dentry_ops;
+
+// What vtfs_mount hands to vtfs_fill_super
+struct vtfs_mount_data {
+  const char* token;  // Mount source
+  char* options;
+};
 
 // Inode ops
 struct dentry* vtfs_lookup(
@@ -29,14 +44,52 @@ int vtfs_rmdir(struct inode* parent_inode, struct dentry* child_dentry);
 int vtfs_link(
     struct dentry* old_dentry, struct inode* parent_dir, struct dentry* new_dentry
 );
+int vtfs_getattr(
+    struct mnt_idmap* idmap,
+    const struct path* path,
+    struct kstat* stat,
+    u32 request_mask,
+    unsigned int query_flags
+);
+
+// Dentry ops
+int vtfs_d_revalidate(
+    struct inode* dir, const struct qstr* name, struct dentry* dentry, unsigned int flags
+);
 
 // Dir ops
 int vtfs_iterate(struct file* filp, struct dir_context* ctx);
 
 // File ops
-ssize_t vtfs_read(struct file* filp, char __user* buffer, size_t len, loff_t* offset);
-ssize_t vtfs_write(struct file* filp, const char __user* buffer, size_t len, loff_t* offset);
+int vtfs_open(struct inode* inode, struct file* filp);
+ssize_t vtfs_read_iter(struct kiocb* iocb, struct iov_iter* to);
+ssize_t vtfs_write_iter(struct kiocb* iocb, struct iov_iter* from);
+ssize_t vtfs_cached_write_iter(struct kiocb* iocb, struct iov_iter* from);
 loff_t vtfs_llseek(struct file *filp, loff_t offset, int whence);
+int vtfs_fsync(struct file* filp, loff_t start, loff_t end, int datasync);
+int vtfs_flush(struct file* filp, fl_owner_t id);
+
+// Address space ops
+int vtfs_read_folio(struct file* filp, struct folio* folio);
+void vtfs_readahead(struct readahead_control* rac);
+int vtfs_write_begin(
+    struct file* filp,
+    struct address_space* mapping,
+    loff_t pos,
+    unsigned int len,
+    struct folio** foliop,
+    void** fsdata
+);
+int vtfs_write_end(
+    struct file* filp,
+    struct address_space* mapping,
+    loff_t pos,
+    unsigned int len,
+    unsigned int copied,
+    struct folio* folio,
+    void* fsdata
+);
+int vtfs_writepages(struct address_space* mapping, struct writeback_control* wbc);
 
 // Mount
 struct dentry* vtfs_mount(
@@ -44,11 +97,12 @@ struct dentry* vtfs_mount(
 );
 int vtfs_fill_super(struct super_block* sb, void* data, int silent);
 void vtfs_kill_sb(struct super_block* sb);
+int vtfs_show_stats(struct seq_file* m, struct dentry* root);
+void vtfs_evict_inode(struct inode* inode);
 
 // Utility
-struct inode* vtfs_get_inode(
-    struct super_block* sb, const struct inode* dir, umode_t mode, int i_ino
-);
+struct inode* vtfs_iget(struct super_block* sb, const struct vtfs_node_meta* meta);
+void vtfs_init_file_inode(struct inode* inode);
 
 // Helper functions for I/O operations
 int vtfs_validate_io_params(loff_t offset, size_t len, loff_t* new_size_out);
@@ -3,6 +3,7 @@
 
 #include <linux/fs.h>
 #include <linux/limits.h>
+#include <linux/uio.h>
 
 #define VTFS_ROOT_INO 1000
 
@@ -19,6 +20,7 @@ struct vtfs_node_meta {
   enum vtfs_node_type type;
   umode_t mode;
   loff_t size;
+  unsigned int nlink;  // 0 if the storage did not report it along
 };
 
 struct vtfs_dirent {
@@ -27,16 +29,64 @@ struct vtfs_dirent {
   enum vtfs_node_type type;
 };
 
+// Directory entry together with the attributes a lookup would return
+struct vtfs_dirent_plus {
+  struct vtfs_dirent dirent;
+  struct vtfs_node_meta meta;
+  unsigned long offset;  // Cookie of the entry after this one
+};
+
+// Wire protocol of the net storage
+enum vtfs_net_proto {
+  VTFS_PROTO_HTTP,
+  VTFS_PROTO_RPC,
+};
+
+// Per-mount state, sb->s_fs_info
+struct vtfs_sb_info {
+  void* storage;  // Owned by the storage implementation
+  unsigned long dentry_ttl;  // Jiffies a remote lookup result is trusted for
+  unsigned long attr_ttl;    // Jiffies remote attributes are trusted for
+  enum vtfs_net_proto proto;
+  bool writeback;  // Buffer writes of remote files in the page cache, store them later
+};
+
+static inline struct vtfs_sb_info* VTFS_SB(struct super_block* sb) {
+  return sb->s_fs_info;
+}
+
+// Storage capabilities
+#define VTFS_STORAGE_PAGE_CACHE (1 << 0)  // Regular files are cached and can be mmap'ed
+#define VTFS_STORAGE_REMOTE (1 << 1)      // Namespace may change behind our back
+#define VTFS_STORAGE_PARALLEL_IO (1 << 2) // Data calls on disjoint ranges of a file may overlap in time
+
 struct vtfs_storage_ops {
+  unsigned int flags;
+  // Optional. Module-wide setup and teardown, e.g. slab caches
+  int (*global_init)(void);
+  void (*global_exit)(void);
   int (*init)(struct super_block* sb, const char* token);
   void (*shutdown)(struct super_block* sb);
   int (*get_root)(struct super_block* sb, struct vtfs_node_meta* out);
   int (*lookup)(
       struct super_block* sb, vtfs_ino_t parent, const char* name, struct vtfs_node_meta* out
   );
+  // Return the first entry at or after *offset and move *offset past it.
+  // Offsets are opaque cookies that stay valid while entries come and go
   int (*iterate_dir)(
       struct super_block* sb, vtfs_ino_t dir_ino, unsigned long* offset, struct vtfs_dirent* out
   );
+  // Optional. Fill up to max entries at or after *offset with their
+  // attributes and move *offset past the last one. Returns the number of
+  // entries, 0 at the end of the directory, -EOPNOTSUPP to have the
+  // directory listed with iterate_dir instead
+  int (*iterate_dir_plus)(
+      struct super_block* sb,
+      vtfs_ino_t dir_ino,
+      unsigned long* offset,
+      struct vtfs_dirent_plus* out,
+      int max
+  );
   int (*create_file)(
       struct super_block* sb,
       vtfs_ino_t parent,
@@ -53,12 +103,29 @@ struct vtfs_storage_ops {
       struct vtfs_node_meta* out
   );
   int (*rmdir)(struct super_block* sb, vtfs_ino_t parent, const char* name);
-  ssize_t (*read)(struct super_block* sb, vtfs_ino_t ino, char* buffer, size_t len, loff_t* offset);
-  ssize_t (*write)(
-      struct super_block* sb, vtfs_ino_t ino, const char* buffer, size_t len, loff_t* offset
-  );
+  // Data transfer. Both advance the iterator and *offset by the returned byte count
+  ssize_t (*read)(struct super_block* sb, vtfs_ino_t ino, struct iov_iter* to, loff_t* offset);
+  ssize_t (*write)(struct super_block* sb, vtfs_ino_t ino, struct iov_iter* from, loff_t* offset);
+  // Optional. Resolve SEEK_DATA/SEEK_HOLE, returns -ENXIO past the last data/EOF
+  loff_t (*seek_hole_data)(struct super_block* sb, vtfs_ino_t ino, loff_t offset, int whence);
   int (*link)(struct super_block* sb, vtfs_ino_t target_ino, vtfs_ino_t parent, const char* name);
   unsigned int (*_count_links)(struct super_block* sb, vtfs_ino_t ino);
+  // Optional. Current attributes of ino, reachable as name in parent. May be
+  // answered from a cache, *fetched is set when they came from the storage
+  int (*getattr)(
+      struct super_block* sb,
+      vtfs_ino_t parent,
+      const char* name,
+      vtfs_ino_t ino,
+      struct vtfs_node_meta* out,
+      unsigned int* nlink,
+      bool* fetched
+  );
+  // Optional. Drop whatever is cached about ino: its links changed or the
+  // inode left memory
+  void (*forget)(struct super_block* sb, vtfs_ino_t ino);
+  // Optional. Append backend statistics to the mount's line in /proc/self/mountstats
+  int (*show_stats)(struct super_block* sb, struct seq_file* m);
 };
 
 // Implementation getters